@@ -0,0 +1,95 @@
+#include <dmatrix/display_model.h>
+#include <dmatrix/driver.h>
+#include <dmatrix/ingest.h>
+#include <dmatrix/udp_source.h>
+
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "memory_driver.h"
+
+using namespace DMAtrix;
+
+// measure the throughput of Ingest for a 64x64 display sent as Art-Net,
+// first decoding packets from memory, then received over loopback UDP
+
+using D = FullDisplay<64, 64, 5>;
+
+using Driver = DisplayDriver<D, MemoryDriver, true>;
+
+int main(int argc, char **argv) {
+  Pins<D> pins{};
+  Driver driver(pins, 1, 8);
+
+  // one frame of packets, ending with a sync
+  std::vector<std::vector<uint8_t>> packets;
+  std::vector<uint8_t> rgb(D::rows * D::cols * D::colors);
+  for (auto &x : rgb) x = rand();
+  uint8_t buf[600];
+  for (size_t start = 0, universe = 1; start < rgb.size();
+       start += 510, universe++) {
+    size_t len = std::min<size_t>(510, rgb.size() - start);
+    size_t n = make_artnet_dmx(buf, universe, rgb.data() + start, len);
+    packets.emplace_back(buf, buf + n);
+  }
+  packets.emplace_back(buf, buf + make_artnet_sync(buf));
+
+  {
+    Ingest<D, Driver> ingest(driver);
+    const size_t frames = 2000;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < frames; i++)
+      for (auto &packet : packets) ingest.handle(packet.data(), packet.size());
+    std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+
+    std::cout << "decode: " << frames / t.count() << " frames/s, "
+              << frames * packets.size() / t.count() << " packets/s"
+              << std::endl;
+  }
+
+  {
+    Ingest<D, Driver> ingest(driver);
+    UDPSource source;
+    if (!source.open(0)) {
+      std::cerr << "failed to open socket" << std::endl;
+      return 1;
+    }
+
+    const size_t frames = 500;
+    std::atomic<bool> sent(false);
+    std::thread sender([&] {
+      int fd = socket(AF_INET, SOCK_DGRAM, 0);
+      sockaddr_in addr = {};
+      addr.sin_family = AF_INET;
+      addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      addr.sin_port = htons(source.port());
+
+      for (size_t i = 0; i < frames; i++) {
+        for (auto &packet : packets)
+          sendto(fd, packet.data(), packet.size(), 0, (sockaddr *)&addr,
+                 sizeof(addr));
+        // don't overrun the socket buffer
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+      }
+      close(fd);
+      sent = true;
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    while (!sent) ingest.poll(source);
+    ingest.poll(source);
+    std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+    sender.join();
+
+    std::cout << "udp: " << ingest.stats.frames / t.count() << " frames/s, "
+              << ingest.stats.packets << "/" << frames * packets.size()
+              << " packets received" << std::endl;
+  }
+}
@@ -0,0 +1,101 @@
+#include <dmatrix/animation.h>
+#include <dmatrix/display_model.h>
+#include <dmatrix/driver.h>
+#include <dmatrix/mapped_file.h>
+#include <dmatrix/playback.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "memory_driver.h"
+
+using namespace DMAtrix;
+
+// measure playback from memory-mapped files on a 64x64 display, for raw
+// frames (encoded on playback) and a pre-encoded animation
+//
+// usage: bench_playback [directory for temporary files]
+
+using D = FullDisplay<64, 64, 5>;
+using Driver = DisplayDriver<D, MemoryDriver, true>;
+
+const size_t num_frames = 300;
+
+/// write data to path, returning false on error
+bool write_file(const std::string &path, const std::vector<uint8_t> &data) {
+  FILE *f = fopen(path.c_str(), "wb");
+  if (!f) return false;
+  bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+  return fclose(f) == 0 && ok;
+}
+
+template <typename Source>
+void bench(const char *name, Driver &driver, Source &source,
+           size_t file_size) {
+  if (!source.ok) {
+    std::cerr << name << ": can't be played on this driver" << std::endl;
+    return;
+  }
+  const size_t loops = 5;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < loops * num_frames; i++) play_frame(driver, source);
+  std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+
+  std::cout << name << ": " << loops * num_frames / t.count() << " frames/s, "
+            << loops * file_size / t.count() / 1e6 << " MB/s mapped, "
+            << file_size / num_frames << " bytes/frame" << std::endl;
+}
+
+int main(int argc, char **argv) {
+  std::string dir = argc > 1 ? argv[1] : "/tmp";
+  Pins<D> pins{};
+  Driver driver(pins, 1, 8);
+
+  // a 16x16 square moving over a static random background
+  const size_t frame_bytes = D::rows * D::cols * D::colors;
+  std::vector<uint8_t> background(frame_bytes);
+  for (auto &x : background) x = rand();
+
+  std::vector<uint8_t> frames;
+  for (size_t i = 0; i < num_frames; i++) {
+    std::vector<uint8_t> frame = background;
+    size_t x = i % (D::cols - 16), y = (i / 4) % (D::rows - 16);
+    for (size_t row = y; row < y + 16; row++)
+      for (size_t col = x; col < x + 16; col++)
+        for (size_t color = 0; color < D::colors; color++)
+          frame[(row * D::cols + col) * D::colors + color] = 255;
+    frames.insert(frames.end(), frame.begin(), frame.end());
+  }
+
+  AnimationCompiler<D, uint32_t> compiler(driver.buffer_model);
+  for (size_t i = 0; i < num_frames; i++)
+    compiler.add_frame(&frames[i * frame_bytes]);
+
+  std::string raw_path = dir + "/bench_playback.raw";
+  std::string anim_path = dir + "/bench_playback.anim";
+  if (!write_file(raw_path, frames) ||
+      !write_file(anim_path, compiler.finish())) {
+    std::cerr << "failed to write files in " << dir << std::endl;
+    return 1;
+  }
+
+  {
+    MappedFile file;
+    file.open(raw_path.c_str());
+    RawSource<D, MappedFile> source(file);
+    bench("raw", driver, source, file.size);
+  }
+
+  {
+    MappedFile file;
+    file.open(anim_path.c_str());
+    AnimationSource<D, MappedFile> source(file, driver);
+    bench("animation", driver, source, file.size);
+  }
+
+  remove(raw_path.c_str());
+  remove(anim_path.c_str());
+}
@@ -0,0 +1,72 @@
+#include <dmatrix/buffer_model.h>
+#include <dmatrix/display_model.h>
+#include <dmatrix/text.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+using namespace DMAtrix;
+
+// compare drawing text with GlyphCache against drawing the same pixels with
+// write_rgb, on a 32x64 display at various bit depths
+
+using D = FullDisplay<32, 64, 4>;
+using B = BufferModel<D>;
+
+template <typename F>
+double time_us(size_t iterations, F f) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; i++) f(i);
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::micro>(end - start).count() /
+         iterations;
+}
+
+int main(int argc, char **argv) {
+  // a 6x8 font with roughly half of the pixels lit
+  std::vector<uint32_t> bitmap(95 * 8);
+  for (auto &row : bitmap) row = rand() & 0x3f;
+  Font font{' ', 95, 6, 8, bitmap.data()};
+
+  const char *text = "Hello, World";
+  const size_t iterations = 20000;
+
+  for (size_t num_bits : {6, 8, 10, 12}) {
+    B b(1, num_bits);
+    std::vector<uint16_t> buf(b.buf_len);
+    b.init_buffer(buf);
+
+    double pixels = time_us(iterations, [&](size_t i) {
+      int col = -(int)(i % 16);
+      for (const char *c = text; *c; c++, col += font.width)
+        for (int y = 0; y < (int)font.height; y++)
+          for (int x = 0; x < (int)font.width; x++) {
+            uint32_t bits = font.bitmap[(*c - font.first) * font.height + y];
+            if (((bits >> x) & 1) && col + x >= 0 && col + x < (int)D::cols)
+              b.write_rgb<uint8_t, 8>(buf, 12 + y, col + x, 255, 128, 0);
+          }
+    });
+
+    GlyphCache<D> cache(font, num_bits, 255, 128, 0);
+    double cached = time_us(iterations, [&](size_t i) {
+      cache.draw_text(12, -(int)(i % 16), text,
+                      [&](size_t bit, size_t addr, size_t word, size_t len,
+                          uint32_t clear, uint32_t set) {
+                        b.update_words(buf, bit, addr, word, len,
+                                       clear << b.data_bit(0),
+                                       set << b.data_bit(0));
+                      },
+                      [&](size_t row, size_t col, uint16_t red,
+                          uint16_t green, uint16_t blue) {
+                        b.write_rgb<uint16_t, 16>(buf, row, col, red, green,
+                                                  blue);
+                      });
+    });
+
+    std::cout << num_bits << " bits: write_rgb " << pixels << "us, GlyphCache "
+              << cached << "us per string (" << pixels / cached << "x)"
+              << std::endl;
+  }
+}
@@ -0,0 +1,82 @@
+#include <dmatrix/buffer_model.h>
+#include <dmatrix/display_model.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+using namespace DMAtrix;
+
+// compare write_rgb against the general write_color loop (which branches on
+// each value bit) on a 32x64 display at various bit depths, writing a random
+// image
+
+using D = FullDisplay<32, 64, 4>;
+using B = BufferModel<D>;
+
+template <typename F>
+double time_us(size_t iterations, F f) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; i++) f(i);
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::micro>(end - start).count() /
+         iterations;
+}
+
+/// write_color without the branch-free path, for comparison
+template <typename T, size_t num_bits_value, typename Buffer>
+void write_color_branching(B &b, Buffer &buf, size_t row, size_t col,
+                           size_t color, T value) {
+  DataAddr addr = D::encode(row, col, color);
+
+  for (size_t bit = 0; bit < b.num_bits; bit++) {
+    int value_bit = (int)bit + (num_bits_value - b.num_bits);
+
+    if (value_bit >= 0 && ((value >> value_bit) & 1))
+      buf[b.buf_idx(bit, addr.addr, D::data_words - addr.word)] |=
+          1 << b.data_bit(addr.bit);
+    else
+      buf[b.buf_idx(bit, addr.addr, D::data_words - addr.word)] &=
+          ~(1 << b.data_bit(addr.bit));
+  }
+}
+
+template <typename T, size_t num_bits_value>
+void bench(size_t num_bits) {
+  const size_t iterations = 200;
+
+  B b(1, num_bits);
+  std::vector<uint16_t> buf(b.buf_len);
+  b.init_buffer(buf);
+
+  std::vector<T> image(D::rows * D::cols * D::colors);
+  for (auto &v : image) v = rand() & ((1 << num_bits_value) - 1);
+
+  double branching = time_us(iterations, [&](size_t i) {
+    const T *px = image.data();
+    for (size_t row = 0; row < D::rows; row++)
+      for (size_t col = 0; col < D::cols; col++)
+        for (size_t color = 0; color < D::colors; color++)
+          write_color_branching<T, num_bits_value>(b, buf, row, col, color,
+                                                   *px++);
+  });
+
+  double branch_free = time_us(iterations, [&](size_t i) {
+    const T *px = image.data();
+    for (size_t row = 0; row < D::rows; row++)
+      for (size_t col = 0; col < D::cols; col++, px += D::colors)
+        b.write_rgb<T, num_bits_value>(buf, row, col, px[0], px[1], px[2]);
+  });
+
+  std::cout << num_bits_value << " -> " << num_bits << " bits: branching "
+            << branching << "us, branch-free " << branch_free
+            << "us per frame (" << branching / branch_free << "x)"
+            << std::endl;
+}
+
+int main(int argc, char **argv) {
+  for (size_t num_bits : {4, 6, 8}) bench<uint8_t, 8>(num_bits);
+  for (size_t num_bits : {8, 10, 12}) bench<uint16_t, 12>(num_bits);
+  bench<uint16_t, 16>(16);
+}
@@ -0,0 +1,50 @@
+#include <dmatrix/animation.h>
+#include <dmatrix/buffer_model.h>
+#include <dmatrix/display_model.h>
+
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+using namespace DMAtrix;
+
+// compile raw 8 bit RGB frames into an animation for AnimationPlayer. The
+// display and buffer configuration must match the target exactly; modify
+// these to suit.
+//
+// for example, to convert a video:
+//    ffmpeg -i in.mp4 -f rawvideo -pix_fmt rgb24 -s 64x32 - > frames.raw
+//    compile_animation < frames.raw > anim.bin
+
+using D = FullDisplay<32, 64, 4>;
+using B = BufferModel<D>;
+B b(4, 8);
+
+// number of buffers in the display driver (1 for CopyForward mode) and word
+// type of the DMA buffer
+const size_t num_buffers = 2;
+using Word = uint16_t;
+
+// add a keyframe this often, or 0 for only the first num_buffers frames
+const size_t keyframe_interval = 0;
+
+int main(int argc, char **argv) {
+  AnimationCompiler<D, Word> compiler(b, num_buffers, keyframe_interval);
+
+  std::vector<uint8_t> rgb(D::rows * D::cols * D::colors);
+  while (fread(rgb.data(), 1, rgb.size(), stdin) == rgb.size())
+    compiler.add_frame(rgb.data());
+
+  std::vector<uint8_t> data = compiler.finish();
+  fwrite(data.data(), 1, data.size(), stdout);
+
+  size_t keyframes = 0;
+  for (size_t i = 0; i < compiler.frames.size(); i++)
+    if (Animation<D>(data.data(), data.size()).keyframe(i)) keyframes++;
+
+  std::cerr << "frames: " << compiler.frames.size() << " (" << keyframes
+            << " keyframes)" << std::endl;
+  std::cerr << "bytes: " << data.size() << " ("
+            << b.buf_len * sizeof(Word) * compiler.frames.size()
+            << " uncompressed)" << std::endl;
+}
@@ -12,6 +12,7 @@ DisplayDriver<D, ESP32I2SDMA, true> driver(pins, 4, 8);
 
 long unsigned int last_print_time;
 size_t count = 0;
+uint32_t last_isr_count = 0, last_isr_cycles = 0;
 
 void setup() {
   Serial.begin(115200);
@@ -49,8 +50,16 @@ void loop() {
   // print an fps counter
   count++;
   if (micros() > last_print_time + 1000000) {
+    uint32_t isr_count = driver.pin_driver.isr_count();
+    uint32_t isr_cycles = driver.pin_driver.isr_cycles();
     Serial.print(count);
-    Serial.println(" fps");
+    Serial.print(" fps, ");
+    Serial.print(isr_count - last_isr_count);
+    Serial.print(" interrupts, ");
+    Serial.print(isr_cycles - last_isr_cycles);
+    Serial.println(" cycles in interrupts");
+    last_isr_count = isr_count;
+    last_isr_cycles = isr_cycles;
     count = 0;
     last_print_time += 1000000;
   }
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <dmatrix/buffer_model.h>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+/// pin driver which just holds the buffers in memory, for benchmarks
+template <size_t num_pins, size_t num_buffers>
+struct MemoryDriver {
+  using dtype = uint32_t;
+  std::array<std::vector<dtype>, num_buffers> buffers;
+
+  struct Config {};
+
+  static constexpr size_t segment_align = 1;
+  static size_t max_segment_len(const Config &config) { return SIZE_MAX; }
+
+  void setup(std::array<int, num_pins> data_pins, int clk_pin, Config config,
+             size_t size, const std::vector<DMAtrix::Segment> &segments) {
+    for (auto &buffer : buffers) buffer.resize(size);
+  }
+
+  uint32_t flips = 0;
+
+  uint32_t flip_to(size_t buf_idx, bool low_latency = false) {
+    return ++flips;
+  }
+
+  bool flip_done() { return true; }
+  bool flip_done(uint32_t seq) { return true; }
+
+  size_t read_position() { return buffers[0].size(); }
+
+  void blank(dtype word, int clkspeed_hz = 0) {}
+  void unblank() {}
+};
@@ -0,0 +1,361 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "buffer_model.h"
+#include "driver.h"
+
+namespace DMAtrix {
+
+  // Pre-encoded animations: a sequence of frames stored as patches to the
+  // data words of a DMA buffer, so that playing a frame is a copy of the
+  // words which changed rather than encoding every pixel.
+  //
+  // An animation is only valid for the display and BufferModel configuration
+  // it was compiled for. Frames are either keyframes, which contain every
+  // data word and can be applied to any buffer, or deltas, which contain the
+  // words which differ from the frame num_buffers before, which must be what
+  // the buffer holds. The first num_buffers frames are keyframes, so that
+  // animations can be looped.
+  //
+  // Layout (all fields are uint32_t in native byte order):
+  //
+  // - AnimationHeader
+  // - num_frames byte offsets of each frame from the start
+  // - frames, each a FrameHeader followed by num_patches patches, each a
+  //   PatchHeader followed by count words of word_size bytes, padded to a
+  //   multiple of 4 bytes
+
+  struct AnimationHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t rows, cols, addr_bits, data_bits;
+    uint32_t num_bits, buf_len, layout_hash;
+    uint32_t word_size;
+    uint32_t num_buffers;
+    uint32_t num_frames;
+  };
+
+  struct FrameHeader {
+    uint32_t num_patches;
+    uint32_t keyframe;
+  };
+
+  struct PatchHeader {
+    uint32_t offset;
+    uint32_t count;
+  };
+
+  /// hash of the subframe layout of model, to check that an animation
+  /// matches the model it is played with
+  template <typename D>
+  uint32_t layout_hash(const BufferModel<D> &model) {
+    uint32_t hash = 2166136261u;  // FNV-1a
+    for (auto &frame : model.subframes)
+      for (size_t x : {frame.bit, frame.addr, frame.oe_length,
+                       frame.data_offset, frame.oe_offset}) {
+        hash ^= (uint32_t)x;
+        hash *= 16777619u;
+      }
+    return hash;
+  }
+
+  /// write count words to buf starting at offset; DMA drivers may overload
+  /// this as for copy_words
+  template <typename Buffer, typename Word>
+  void write_words(Buffer &buf, size_t offset, const Word *words,
+                   size_t count) {
+    for (size_t i = 0; i < count; i++) buf[offset + i] = words[i];
+  }
+
+  /// Compiles frames into an animation for BufferModel<D> model, with words
+  /// of type Word (matching the DMA buffer type).
+  template <typename D, typename Word = uint16_t>
+  struct AnimationCompiler {
+    BufferModel<D> &model;
+    size_t num_buffers;
+    // frames between keyframes after the first num_buffers, or 0 for none
+    size_t keyframe_interval;
+
+    // the encoded buffers of the last num_buffers frames, with the oldest
+    // first
+    std::vector<std::vector<Word>> history;
+    std::vector<std::vector<uint8_t>> frames;
+
+    // patches are merged if separated by no more than this many words, as
+    // a patch header costs about as much
+    size_t merge_gap = sizeof(PatchHeader) / sizeof(Word);
+
+    /// num_buffers should match the display driver; use 1 for CopyForward
+    /// mode, where the back buffer always holds the previous frame
+    AnimationCompiler(BufferModel<D> &model, size_t num_buffers = 2,
+                      size_t keyframe_interval = 0)
+        : model(model),
+          num_buffers(num_buffers),
+          keyframe_interval(keyframe_interval) {}
+
+    /// add a frame of interleaved (r, g, b) values in row-major order
+    template <typename T = uint8_t, size_t num_bits_value = 8>
+    void add_frame(const T *rgb) {
+      std::vector<Word> buf(model.buf_len);
+      model.init_buffer(buf);
+      model.template write_image<T, num_bits_value>(buf, rgb);
+      add_buffer(buf);
+    }
+
+    /// add a frame which has already been encoded by model
+    void add_buffer(const std::vector<Word> &buf) {
+      size_t n = frames.size();
+      bool keyframe = n < num_buffers ||
+                      (keyframe_interval && n % keyframe_interval == 0);
+
+      std::vector<PatchHeader> patches;
+      if (keyframe)
+        data_patches(patches);
+      else
+        diff_patches(history.front(), buf, patches);
+
+      std::vector<uint8_t> frame;
+      append(frame,
+             FrameHeader{(uint32_t)patches.size(), (uint32_t)keyframe});
+      for (auto &patch : patches) {
+        append(frame, patch);
+        size_t start = frame.size();
+        size_t len = patch.count * sizeof(Word);
+        frame.resize(start + ((len + 3) & ~3));
+        memcpy(&frame[start], &buf[patch.offset], len);
+      }
+      frames.push_back(std::move(frame));
+
+      history.push_back(buf);
+      if (history.size() > num_buffers) history.erase(history.begin());
+    }
+
+    /// the complete animation
+    std::vector<uint8_t> finish() const {
+      AnimationHeader header = {{'D', 'M', 'A', 'N'},
+                                1,
+                                D::rows,
+                                D::cols,
+                                D::addr_bits,
+                                D::data_bits,
+                                (uint32_t)model.num_bits,
+                                (uint32_t)model.buf_len,
+                                layout_hash(model),
+                                sizeof(Word),
+                                (uint32_t)num_buffers,
+                                (uint32_t)frames.size()};
+
+      std::vector<uint8_t> out;
+      append(out, header);
+
+      size_t offset = sizeof(header) + frames.size() * sizeof(uint32_t);
+      for (auto &frame : frames) {
+        append(out, (uint32_t)offset);
+        offset += frame.size();
+      }
+      for (auto &frame : frames)
+        out.insert(out.end(), frame.begin(), frame.end());
+      return out;
+    }
+
+    template <typename T>
+    static void append(std::vector<uint8_t> &out, const T &value) {
+      const uint8_t *p = (const uint8_t *)&value;
+      out.insert(out.end(), p, p + sizeof(T));
+    }
+
+    void add_patch(std::vector<PatchHeader> &patches, size_t begin,
+                   size_t end) {
+      if (!patches.empty() &&
+          patches.back().offset + patches.back().count + merge_gap >= begin)
+        patches.back().count = end - patches.back().offset;
+      else
+        patches.push_back({(uint32_t)begin, (uint32_t)(end - begin)});
+    }
+
+    /// patches covering the data regions of every subframe, in buffer order
+    void data_patches(std::vector<PatchHeader> &patches) {
+      std::vector<std::pair<size_t, size_t>> regions;
+      for (auto &frame : model.subframes) {
+        size_t begin = frame.data_offset + 1;
+        size_t end = frame.data_offset + D::data_words + 1;
+        if (end > model.buf_len) {
+          regions.push_back({0, end - model.buf_len});
+          end = model.buf_len;
+        }
+        regions.push_back({begin, end});
+      }
+      std::sort(regions.begin(), regions.end());
+      for (auto &region : regions)
+        add_patch(patches, region.first, region.second);
+    }
+
+    /// patches covering the words which differ between old_buf and buf
+    void diff_patches(const std::vector<Word> &old_buf,
+                      const std::vector<Word> &buf,
+                      std::vector<PatchHeader> &patches) {
+      for (size_t i = 0; i < buf.size();) {
+        if (buf[i] == old_buf[i]) {
+          i++;
+          continue;
+        }
+        size_t end = i + 1;
+        while (end < buf.size() && buf[end] != old_buf[end]) end++;
+        add_patch(patches, i, end);
+        i = end;
+      }
+    }
+  };
+
+  /// Reads an animation made by AnimationCompiler from memory, which is not
+  /// copied.
+  template <typename D>
+  struct Animation {
+    const uint8_t *data;
+    size_t len;
+
+    Animation(const uint8_t *data, size_t len) : data(data), len(len) {}
+
+    const AnimationHeader &header() const {
+      return *(const AnimationHeader *)data;
+    }
+
+    size_t num_frames() const { return header().num_frames; }
+
+    /// check that this animation can be played on buffers of Word
+    /// initialised by model, including that every frame and patch lies
+    /// within the data and every patch within the buffer
+    template <typename Word>
+    bool compatible(const BufferModel<D> &model) const {
+      if (len < sizeof(AnimationHeader)) return false;
+      const AnimationHeader &h = header();
+      return memcmp(h.magic, "DMAN", 4) == 0 && h.version == 1 &&
+             h.rows == D::rows && h.cols == D::cols &&
+             h.addr_bits == D::addr_bits && h.data_bits == D::data_bits &&
+             h.num_bits == model.num_bits && h.buf_len == model.buf_len &&
+             h.layout_hash == layout_hash(model) &&
+             h.word_size == sizeof(Word) &&
+             h.num_frames <=
+                 (len - sizeof(AnimationHeader)) / sizeof(uint32_t) &&
+             frames_valid();
+    }
+
+    /// check the bounds of every frame and patch, given a valid header
+    bool frames_valid() const {
+      const AnimationHeader &h = header();
+      size_t table_end =
+          sizeof(AnimationHeader) + h.num_frames * sizeof(uint32_t);
+
+      for (size_t frame = 0; frame < h.num_frames; frame++) {
+        size_t begin = frame_offset(frame);
+        size_t end = frame + 1 < h.num_frames ? frame_offset(frame + 1) : len;
+        if (begin < table_end || begin % 4 || end > len || begin > end ||
+            end - begin < sizeof(FrameHeader))
+          return false;
+
+        const uint8_t *p = data + begin + sizeof(FrameHeader);
+        const uint8_t *frame_end = data + end;
+        const FrameHeader *frame_header = (const FrameHeader *)(data + begin);
+        for (size_t i = 0; i < frame_header->num_patches; i++) {
+          if ((size_t)(frame_end - p) < sizeof(PatchHeader)) return false;
+          const PatchHeader *patch = (const PatchHeader *)p;
+          p += sizeof(PatchHeader);
+          if (patch->offset > h.buf_len ||
+              patch->count > h.buf_len - patch->offset)
+            return false;
+
+          size_t bytes = ((size_t)patch->count * h.word_size + 3) & ~3;
+          if ((size_t)(frame_end - p) < bytes) return false;
+          p += bytes;
+        }
+      }
+      return true;
+    }
+
+    /// check that this animation can be played on driver: it must not be
+    /// framebuffered (flip would overwrite the patches with the
+    /// framebuffer), be compatible with its buffers, have at least one
+    /// frame, and be compiled for the number of flips after which the back
+    /// buffer holds a frame again (1 in CopyForward mode)
+    template <typename Driver>
+    bool playable(const Driver &driver) const {
+      if (Driver::uses_framebuffer) return false;
+      using Word = std::decay_t<decltype(
+          std::declval<Driver &>().pin_driver.buffers[0][0])>;
+      if (!compatible<Word>(driver.buffer_model)) return false;
+      size_t num_buffers = driver.flip_mode == FlipMode::CopyForward
+                               ? 1
+                               : Driver::num_buffers;
+      return header().num_frames > 0 && header().num_buffers == num_buffers;
+    }
+
+    bool keyframe(size_t frame) const {
+      return ((const FrameHeader *)frame_data(frame))->keyframe;
+    }
+
+    size_t frame_offset(size_t frame) const {
+      const uint32_t *offsets =
+          (const uint32_t *)(data + sizeof(AnimationHeader));
+      return offsets[frame];
+    }
+
+    size_t frame_size(size_t frame) const {
+      size_t end = frame + 1 < num_frames() ? frame_offset(frame + 1) : len;
+      return end - frame_offset(frame);
+    }
+
+    const uint8_t *frame_data(size_t frame) const {
+      return data + frame_offset(frame);
+    }
+
+    /// Apply frame to buf. Unless the frame is a keyframe, buf must hold frame
+    /// (frame - num_buffers) modulo the number of frames.
+    template <typename Buffer>
+    void apply(Buffer &buf, size_t frame) const {
+      using Word = std::remove_reference_t<decltype(buf[0])>;
+      const uint8_t *p = frame_data(frame);
+      const FrameHeader *frame_header = (const FrameHeader *)p;
+      p += sizeof(FrameHeader);
+
+      for (size_t i = 0; i < frame_header->num_patches; i++) {
+        const PatchHeader *patch = (const PatchHeader *)p;
+        p += sizeof(PatchHeader);
+        write_words(buf, patch->offset, (const Word *)p, patch->count);
+        p += (patch->count * sizeof(Word) + 3) & ~3;
+      }
+    }
+  };
+
+  /// Plays an animation on a (non-framebuffered) DisplayDriver, looping.
+  /// Animations which aren't playable on the driver (see Animation::playable)
+  /// are rejected: ok is false, and nothing is shown.
+  template <typename D, typename Driver>
+  struct AnimationPlayer {
+    Driver &driver;
+    Animation<D> animation;
+    size_t frame = 0;
+    bool ok;
+
+    AnimationPlayer(Driver &driver, const Animation<D> &animation)
+        : driver(driver),
+          animation(animation),
+          ok(animation.playable(driver)) {}
+
+    /// wait for the last flip, then show the next frame; returns false if
+    /// the animation was rejected
+    bool next() {
+      if (!ok) return false;
+      while (!driver.flip_done()) {
+      }
+      animation.apply(driver.pin_driver.buffers[driver.back_buffer], frame);
+      driver.flip();
+      frame = (frame + 1) % animation.num_frames();
+      return true;
+    }
+  };
+
+}
@@ -1,11 +1,54 @@
 #pragma once
 
 #include <algorithm>
+#include <cstdint>
 #include <vector>
 #include "display_model.h"
+#include "transpose.h"
 
 namespace DMAtrix {
 
+  /// copy words [begin, end) from src to dst. DMA drivers may overload this
+  /// for their buffer types with a faster version; see copy_data for the
+  /// requirements.
+  template <typename Buffer>
+  void copy_words(Buffer &dst, Buffer &src, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) dst[i] = src[i];
+  }
+
+  /// Make dst the same as src without copying, if the buffers can share
+  /// storage, returning false if they can't; see COWBuffers.
+  template <typename Buffer>
+  bool share_buffer(Buffer &dst, Buffer &src) {
+    return false;
+  }
+
+  /// Call init(view) to write what every buffer starts with, where view is
+  /// indexed like buf, returning false if the other buffers must be written
+  /// separately. Buffers which share storage overload this to write it once,
+  /// without copying; see COWView.
+  template <typename Buffer, typename Init>
+  bool init_shared(Buffer &buf, Init init) {
+    init(buf);
+    return false;
+  }
+
+  /// read word idx of buf, for buffers whose operator[] does more than that
+  /// to overload; see COWView
+  template <typename Buffer>
+  uint32_t read_word(Buffer &buf, size_t idx) {
+    return buf[idx];
+  }
+
+  /// A section of a DMA buffer, from start to the start of the next segment.
+  /// If flip_point is set, start is between the data regions of two
+  /// subframes, so the DMA can switch to another buffer there without mixing
+  /// the data for one subframe from two frames.
+  struct Segment {
+    size_t start;
+    bool flip_point;
+  };
+
   template <typename D>
   struct BufferModel {
     size_t num_bits;
@@ -22,25 +65,41 @@ namespace DMAtrix {
 
     std::vector<SubFrame> subframes;
 
-    void allocate_subframes(size_t min_pulse) {
+    // the OE length of each bitplane, in clocks
+    std::vector<size_t> weights;
+
+    /// OE lengths for a linear brightness scale
+    static std::vector<size_t> binary_weights(size_t min_pulse,
+                                              size_t num_bits) {
+      std::vector<size_t> res;
+      for (size_t bit = 0; bit < num_bits; bit++)
+        res.push_back(min_pulse << bit);
+      return res;
+    }
+
+    void allocate_subframes() {
       for (size_t i = 0; i < num_bits; i++) {
         // interleave the high and low bits to distribute the gaps more evenly
         size_t bit = (i & 1) == 0 ? i : (num_bits & ~1) - i;
         for (size_t addr = 0; addr < (1 << D::addr_bits); addr++)
-          subframes.push_back({bit, addr, min_pulse << bit});
+          subframes.push_back({bit, addr, weights[bit]});
       }
     }
 
-    void pack_subframes() {
-      for (size_t i = 0; i < subframes.size(); i++) {
+    /// pack subframes as tightly as possible, then add padding words (with
+    /// the display off) spread evenly between them
+    void pack_subframes(size_t padding = 0) {
+      size_t n = subframes.size();
+      for (size_t i = 0; i < n; i++) {
         SubFrame &frame = subframes[i];
-        SubFrame &next_frame = subframes[(i + 1) % subframes.size()];
+        SubFrame &next_frame = subframes[(i + 1) % n];
 
         size_t data_end = frame.data_offset + D::data_words;
         frame.oe_offset = data_end + 1;
         size_t oe_end = frame.oe_offset + frame.oe_length;
 
-        next_frame.data_offset = std::max(data_end, oe_end - D::data_words);
+        next_frame.data_offset = std::max(data_end, oe_end - D::data_words) +
+                                 padding * (i + 1) / n - padding * i / n;
       }
 
       // above procedure calculates the data offset the first subframe as being
@@ -77,17 +136,88 @@ namespace DMAtrix {
       }
     }
 
-    BufferModel(size_t min_pulse, size_t num_bits) : num_bits(num_bits) {
-      allocate_subframes(min_pulse);
+    /// value of the static (OE, LE and address) bits at position pos in the
+    /// buffer, as written by init_buffer
+    uint32_t static_word(size_t pos) {
+      uint32_t word = 1 << oe_bit();
+
+      for (size_t i = 0; i < subframes.size(); i++) {
+        SubFrame &frame_a = subframes[i];
+        SubFrame &frame_b = subframes[(i + 1) % subframes.size()];
+
+        if (pos == (frame_a.data_offset + D::data_words) % buf_len)
+          word |= 1 << le_bit();
+
+        size_t oe_start = frame_a.oe_offset % buf_len;
+        if ((pos + buf_len - oe_start) % buf_len < frame_a.oe_length)
+          word &= ~(1 << oe_bit());
+
+        size_t addr_start = frame_a.addr_transition;
+        size_t addr_len =
+            (frame_b.addr_transition + buf_len - addr_start) % buf_len;
+        if ((pos + buf_len - addr_start) % buf_len < addr_len)
+          word |= addr_enc(frame_a.addr);
+      }
+
+      return word;
+    }
+
+    struct StaticRun {
+      size_t start;
+      uint32_t value;
+    };
+
+    // run-length encoded static bits, used to generate the waveform without a
+    // complete buffer; each run lasts until the start of the next
+    std::vector<StaticRun> static_runs;
+
+    void fill_static_runs() {
+      std::vector<size_t> edges{0};
+      for (auto &frame : subframes) {
+        size_t le_pos = (frame.data_offset + D::data_words) % buf_len;
+        edges.push_back(le_pos);
+        edges.push_back((le_pos + 1) % buf_len);
+        edges.push_back(frame.oe_offset % buf_len);
+        edges.push_back((frame.oe_offset + frame.oe_length) % buf_len);
+        edges.push_back(frame.addr_transition);
+      }
+      std::sort(edges.begin(), edges.end());
+      edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+      static_runs.clear();
+      for (size_t edge : edges) {
+        uint32_t value = static_word(edge);
+        if (static_runs.empty() || static_runs.back().value != value)
+          static_runs.push_back({edge, value});
+      }
+    }
+
+    /// If min_buf_len is given and the packed buffer is shorter, padding is
+    /// added to make it that long, to fix the refresh rate; see
+    /// solve_refresh_rate.
+    BufferModel(size_t min_pulse, size_t num_bits, size_t min_buf_len = 0)
+        : BufferModel(binary_weights(min_pulse, num_bits), min_buf_len) {}
+
+    /// Show bitplane bit for weights[bit] clocks. With non-binary weights,
+    /// brightness is not linear in the value written, so values should be
+    /// mapped through a table; see gamma_codes.
+    BufferModel(const std::vector<size_t> &weights, size_t min_buf_len = 0)
+        : num_bits(weights.size()), weights(weights) {
+      allocate_subframes();
       pack_subframes();
+      if (min_buf_len > buf_len) pack_subframes(min_buf_len - buf_len);
       calc_addr_transitions();
       fill_data_offsets();
+      fill_static_runs();
     }
 
     size_t buf_len;
 
+    // the data for the last subframe may end on the word which also holds
+    // its LE pulse, at the start of the buffer
     size_t buf_idx(size_t bit, size_t addr, size_t word) {
-      return data_offset(bit, addr) + word;
+      size_t idx = data_offset(bit, addr) + word;
+      return idx < buf_len ? idx : idx - buf_len;
     }
 
     static constexpr int oe_bit() { return 0; }
@@ -96,6 +226,40 @@ namespace DMAtrix {
     static constexpr int addr_enc(size_t addr) { return addr << 2; }
     static constexpr int data_bit(size_t bit) { return 2 + D::addr_bits + bit; }
 
+    /// output while blanked: OE high
+    static constexpr uint32_t blank_word() { return 1 << oe_bit(); }
+
+    /// Split the buffer into segments (e.g. DMA descriptors) of at most
+    /// max_len words, starting at multiples of align. Segments end at flip
+    /// points where possible, so a buffer can be switched part way through a
+    /// refresh at the end of any segment with flip_point set on the next.
+    std::vector<Segment> segments(size_t max_len, size_t align = 1) {
+      // the subframe whose data is in each word, or -1
+      std::vector<int> owner(buf_len, -1);
+      for (size_t i = 0; i < subframes.size(); i++)
+        for (size_t j = 1; j <= D::data_words; j++)
+          owner[(subframes[i].data_offset + j) % buf_len] = i;
+
+      auto flip_point = [&](size_t pos) {
+        int before = owner[(pos + buf_len - 1) % buf_len];
+        return before == -1 || before != owner[pos];
+      };
+
+      std::vector<Segment> res{{0, flip_point(0)}};
+      while (buf_len - res.back().start > max_len) {
+        size_t start = res.back().start;
+        size_t limit = (start + max_len) / align * align;
+
+        size_t pos = limit;
+        while (pos > start && !flip_point(pos)) pos -= align;
+        if (pos > start)
+          res.push_back({pos, true});
+        else
+          res.push_back({limit, false});
+      }
+      return res;
+    }
+
     template <typename Buffer>
     void init_buffer(Buffer &buf) {
       for (size_t i = 0; i < buf_len; i++) buf[i] = 1 << oe_bit();
@@ -126,6 +290,20 @@ namespace DMAtrix {
                      T value) {
       DataAddr addr = D::encode(row, col, color);
 
+      // usual case: every bitplane takes a bit of value, so the update can be
+      // done without data-dependent branches
+      if (num_bits_value >= num_bits) {
+        uint32_t v = (uint32_t)value >> (num_bits_value - num_bits);
+        uint32_t mask = 1 << data_bit(addr.bit);
+
+        for (size_t bit = 0; bit < num_bits; bit++) {
+          size_t idx = buf_idx(bit, addr.addr, D::data_words - addr.word);
+          uint32_t set = -((v >> bit) & 1) & mask;
+          buf[idx] = (buf[idx] & ~mask) | set;
+        }
+        return;
+      }
+
       for (size_t bit = 0; bit < num_bits; bit++) {
         int value_bit = (int)bit + (num_bits_value - num_bits);
 
@@ -138,12 +316,395 @@ namespace DMAtrix {
       }
     }
 
+    /// Generate len words of the waveform starting at position start into
+    /// out[0, len), taking the data from frame (a BitplaneFramebuffer). The
+    /// output wraps around the end of the buffer, and matches the result of
+    /// init_buffer followed by writing the same pixels.
+    template <typename Out, typename Frame>
+    void render(Out &out, size_t start, size_t len, const Frame &frame) {
+      assert(start < buf_len && len <= buf_len);
+
+      // static bits
+      size_t run = std::upper_bound(static_runs.begin(), static_runs.end(),
+                                    start,
+                                    [](size_t pos, const StaticRun &run) {
+                                      return pos < run.start;
+                                    }) -
+                   static_runs.begin() - 1;
+      size_t pos = start;
+      for (size_t i = 0; i < len;) {
+        size_t run_end = run + 1 < static_runs.size()
+                             ? static_runs[run + 1].start
+                             : buf_len;
+        size_t n = std::min(run_end - pos, len - i);
+        for (size_t j = 0; j < n; j++) out[i + j] = static_runs[run].value;
+        i += n;
+        pos += n;
+
+        if (pos == run_end) run++;
+        if (pos == buf_len) pos = run = 0;
+      }
+
+      // data bits for each subframe which overlaps the output; data for word
+      // w is at data_offset + data_words - w
+      for (auto &frame_a : subframes) {
+        auto *plane = frame.plane(frame_a.bit, frame_a.addr);
+        size_t rel = (frame_a.data_offset + 1 + buf_len - start) % buf_len;
+
+        size_t end = std::min(rel + D::data_words, len);
+        for (size_t i = rel; i < end; i++)
+          out[i] |= plane[D::data_words - 1 - (i - rel)] << data_bit(0);
+
+        if (rel + D::data_words > buf_len) {
+          size_t wrapped_end = std::min(rel + D::data_words - buf_len, len);
+          for (size_t i = 0; i < wrapped_end; i++)
+            out[i] |= plane[D::data_words - 1 - (i + buf_len - rel)]
+                      << data_bit(0);
+        }
+      }
+    }
+
+    /// Copy all data bits from frame (a BitplaneFramebuffer) into buf, one
+    /// word per store, leaving the static bits untouched.
+    template <typename Buffer, typename Frame>
+    void write_frame(Buffer &buf, const Frame &frame) {
+      for (auto &frame_a : subframes) write_subframe(buf, frame, frame_a);
+    }
+
+    /// copy the data bits for one subframe from frame into buf
+    template <typename Buffer, typename Frame>
+    void write_subframe(Buffer &buf, const Frame &frame,
+                        const SubFrame &frame_a) {
+      constexpr uint32_t data_mask = ((1u << D::data_bits) - 1)
+                                     << data_bit(0);
+      auto *plane = frame.plane(frame_a.bit, frame_a.addr);
+
+      // only word 0 can wrap around the end of the buffer
+      size_t end = frame_a.data_offset + D::data_words;
+      for (size_t word = D::data_words - 1; word > 0; word--)
+        buf[end - word] =
+            (buf[end - word] & ~data_mask) | (plane[word] << data_bit(0));
+
+      size_t idx = buf_idx(frame_a.bit, frame_a.addr, D::data_words);
+      buf[idx] = (buf[idx] & ~data_mask) | (plane[0] << data_bit(0));
+    }
+
+    /// the position just after the LE word of a subframe; once the DMA has
+    /// reached this in a refresh, its data can be replaced without tearing
+    size_t latched_position(const SubFrame &frame) const {
+      return (frame.data_offset + D::data_words) % buf_len + 1;
+    }
+
+    // subframes not yet latched in write_frame_behind, kept between calls so
+    // that flip doesn't allocate
+    std::vector<const SubFrame *> behind_scratch;
+
+    /// Copy frame into buf as write_frame does, while buf is being output,
+    /// without tearing: each subframe is written only once position() (the
+    /// DMA read position in buf, from the pin driver) shows that it has been
+    /// latched in the current refresh, so that the next refresh shows only
+    /// the new frame. position must take at least two values per refresh
+    /// (or this never returns), and must be polled more often than once per
+    /// refresh.
+    template <typename Buffer, typename Frame, typename Position>
+    void write_frame_behind(Buffer &buf, const Frame &frame,
+                            Position position) {
+      std::vector<const SubFrame *> &ahead = behind_scratch;
+      ahead.clear();
+      size_t last = position();
+
+      for (auto &frame_a : subframes)
+        if (latched_position(frame_a) <= last)
+          write_subframe(buf, frame, frame_a);
+        else
+          ahead.push_back(&frame_a);
+
+      std::sort(ahead.begin(), ahead.end(),
+                [&](const SubFrame *a, const SubFrame *b) {
+                  return latched_position(*a) < latched_position(*b);
+                });
+
+      for (const SubFrame *frame_a : ahead) {
+        // once the position wraps around, the rest have all been latched
+        while (latched_position(*frame_a) > last) {
+          size_t pos = position();
+          if (pos < last) {
+            last = SIZE_MAX;
+            break;
+          }
+          last = pos;
+        }
+        write_subframe(buf, frame, *frame_a);
+      }
+    }
+
+    /// apply (x & ~clear) | set to words [word, word + len) of the data for
+    /// (bit, addr)
+    template <typename Buffer>
+    void update_words(Buffer &buf, size_t bit, size_t addr, size_t word,
+                      size_t len, uint32_t clear, uint32_t set) {
+      size_t end = data_offset(bit, addr) + D::data_words;
+      size_t word_end = word + len;
+
+      if (word == 0 && len) {
+        size_t idx = buf_idx(bit, addr, D::data_words);
+        buf[idx] = (buf[idx] & ~clear) | set;
+        word++;
+      }
+
+      for (; word < word_end; word++)
+        buf[end - word] = (buf[end - word] & ~clear) | set;
+    }
+
+    /// set len pixels along a row starting at (row, col) to one color. Each
+    /// bitplane is written with one masked store per word, covering all colors
+    /// which share that word.
+    template <typename T, size_t num_bits_value, typename Buffer>
+    void fill_span(Buffer &buf, size_t row, size_t col, size_t len, T r, T g,
+                   T b) {
+      T values[D::colors] = {r, g, b};
+      SpanLayout<D> layout(row, col, len);
+
+      for (size_t color = 0; color < D::colors; color++)
+        if (!layout.contiguous[color])
+          for (size_t i = 0; i < len; i++)
+            write_color<T, num_bits_value>(buf, row, col + i, color,
+                                           values[color]);
+
+      for (size_t group_idx = 0; group_idx < layout.num_groups; group_idx++) {
+        auto &group = layout.groups[group_idx];
+
+        uint32_t clear = 0;
+        for (size_t i = 0; i < group.num_colors; i++)
+          clear |= 1 << data_bit(layout.bits[group.colors[i]]);
+
+        for (size_t bit = 0; bit < num_bits; bit++) {
+          int value_bit = (int)bit + (num_bits_value - num_bits);
+
+          uint32_t set = 0;
+          for (size_t i = 0; value_bit >= 0 && i < group.num_colors; i++) {
+            size_t color = group.colors[i];
+            if ((values[color] >> value_bit) & 1)
+              set |= 1 << data_bit(layout.bits[color]);
+          }
+
+          update_words(buf, bit, group.addr.addr, group.addr.word, len, clear,
+                       set);
+        }
+      }
+    }
+
+    /// write len pixels along a row starting at (row, col), from rgb, which
+    /// contains len interleaved (r, g, b) triples
+    template <typename T, size_t num_bits_value, typename Buffer>
+    void write_span(Buffer &buf, size_t row, size_t col, size_t len,
+                    const T *rgb) {
+      SpanLayout<D> layout(row, col, len);
+
+      for (size_t color = 0; color < D::colors; color++)
+        if (!layout.contiguous[color])
+          for (size_t i = 0; i < len; i++)
+            write_color<T, num_bits_value>(buf, row, col + i, color,
+                                           rgb[D::colors * i + color]);
+
+      for (size_t group_idx = 0; group_idx < layout.num_groups; group_idx++) {
+        auto &group = layout.groups[group_idx];
+
+        uint32_t clear = 0;
+        for (size_t i = 0; i < group.num_colors; i++)
+          clear |= 1 << data_bit(layout.bits[group.colors[i]]);
+
+        for (size_t bit = 0; bit < num_bits; bit++) {
+          int value_bit = (int)bit + (num_bits_value - num_bits);
+          if (value_bit < 0) {
+            update_words(buf, bit, group.addr.addr, group.addr.word, len,
+                         clear, 0);
+            continue;
+          }
+
+          for (size_t i = 0; i < len; i++) {
+            uint32_t set = 0;
+            for (size_t j = 0; j < group.num_colors; j++) {
+              size_t color = group.colors[j];
+              set |= ((rgb[D::colors * i + color] >> value_bit) & 1)
+                     << data_bit(layout.bits[color]);
+            }
+
+            size_t idx = buf_idx(bit, group.addr.addr,
+                                 D::data_words - (group.addr.word + i));
+            buf[idx] = (buf[idx] & ~clear) | set;
+          }
+        }
+      }
+    }
+
+    /// Copy the data regions of every subframe from src to dst; both must have
+    /// been initialised with init_buffer. Implementations of copy_words may
+    /// also copy some words around each region, as the static bits are the
+    /// same in both buffers.
+    template <typename Buffer>
+    void copy_data(Buffer &dst, Buffer &src) {
+      for (auto &frame : subframes) {
+        size_t begin = frame.data_offset + 1;
+        size_t end = frame.data_offset + D::data_words + 1;
+        if (end > buf_len) {
+          copy_words(dst, src, 0, end - buf_len);
+          end = buf_len;
+        }
+        copy_words(dst, src, begin, end);
+      }
+    }
+
+    /// Write a whole image, with the values for each word transposed into
+    /// bitplanes by Kernel. rgb holds interleaved (r, g, b) values in
+    /// row-major order. Displays which don't lay out pixels like FullDisplay
+    /// are written pixel by pixel.
+    template <typename T, size_t num_bits_value,
+              typename Kernel = TransposeBest, typename Buffer>
+    void write_image(Buffer &buf, const T *rgb) {
+      static const TransposeLayout<D> layout;
+      if (!layout.supported) {
+        for (size_t row = 0; row < D::rows; row++)
+          for (size_t col = 0; col < D::cols; col++) {
+            const T *px = rgb + (row * D::cols + col) * D::colors;
+            write_rgb<T, num_bits_value>(buf, row, col, px[0], px[1], px[2]);
+          }
+        return;
+      }
+
+      constexpr uint32_t data_mask = ((1u << D::data_bits) - 1)
+                                     << data_bit(0);
+      transpose_image<D, Kernel>(
+          layout, rgb, [&](size_t addr, size_t word, const uint32_t *planes) {
+            for (size_t bit = 0; bit < num_bits; bit++) {
+              int value_bit = (int)bit + (num_bits_value - num_bits);
+              uint32_t data = value_bit >= 0 ? planes[value_bit] : 0;
+
+              size_t idx = buf_idx(bit, addr, D::data_words - word);
+              buf[idx] = (buf[idx] & ~data_mask) | (data << data_bit(0));
+            }
+          });
+    }
+
     template <typename T, size_t num_bits_value, typename Buffer>
     void write_rgb(Buffer &buf, size_t row, size_t col, T r, T g, T b) {
       write_color<T, num_bits_value>(buf, row, col, 0, r);
       write_color<T, num_bits_value>(buf, row, col, 1, g);
       write_color<T, num_bits_value>(buf, row, col, 2, b);
     }
+
+    /// read back one color of a pixel, as written by write_color; see
+    /// decode_value
+    template <typename T, size_t num_bits_value, typename Buffer>
+    T read_color(Buffer &buf, size_t row, size_t col, size_t color) {
+      DataAddr addr = D::encode(row, col, color);
+      uint32_t code = 0;
+      for (size_t bit = 0; bit < num_bits; bit++) {
+        uint32_t word =
+            read_word(buf, buf_idx(bit, addr.addr, D::data_words - addr.word));
+        code |= ((word >> data_bit(addr.bit)) & 1) << bit;
+      }
+      return decode_value<T, num_bits_value>(code, num_bits);
+    }
+
+    template <typename T, size_t num_bits_value, typename Buffer>
+    void read_rgb(Buffer &buf, size_t row, size_t col, T &r, T &g, T &b) {
+      r = read_color<T, num_bits_value>(buf, row, col, 0);
+      g = read_color<T, num_bits_value>(buf, row, col, 1);
+      b = read_color<T, num_bits_value>(buf, row, col, 2);
+    }
+
+    /// Read len pixels along a row starting at (row, col) into rgb, as len
+    /// interleaved (r, g, b) triples. Displays which lay out pixels like
+    /// FullDisplay are transposed back a batch of words at a time, as in
+    /// read_image; otherwise each word read serves every color in it.
+    template <typename T, size_t num_bits_value, typename Buffer>
+    void read_span(Buffer &buf, size_t row, size_t col, size_t len, T *rgb) {
+      static const TransposeLayout<D> transpose_layout;
+      if (transpose_layout.supported) {
+        size_t addr = D::encode(row, col, 0).addr;
+        size_t lines[D::colors];
+        for (size_t color = 0; color < D::colors; color++)
+          lines[color] = D::encode(row, col, color).bit;
+
+        untranspose_words<D, T>(
+            col, col + len,
+            [&](size_t word, uint32_t *planes) {
+              read_planes<T, num_bits_value>(buf, addr, word, planes);
+            },
+            [&](size_t word, const uint32_t *values) {
+              T *px = rgb + (word - col) * D::colors;
+              for (size_t color = 0; color < D::colors; color++)
+                px[color] = (T)values[lines[color]];
+            });
+        return;
+      }
+
+      SpanLayout<D> layout(row, col, len);
+
+      for (size_t color = 0; color < D::colors; color++)
+        if (!layout.contiguous[color])
+          for (size_t i = 0; i < len; i++)
+            rgb[D::colors * i + color] =
+                read_color<T, num_bits_value>(buf, row, col + i, color);
+
+      for (size_t group_idx = 0; group_idx < layout.num_groups; group_idx++) {
+        auto &group = layout.groups[group_idx];
+
+        for (size_t i = 0; i < len; i++) {
+          uint32_t codes[D::colors] = {0};
+          for (size_t bit = 0; bit < num_bits; bit++) {
+            uint32_t word =
+                read_word(buf, buf_idx(bit, group.addr.addr,
+                                       D::data_words - (group.addr.word + i)));
+            for (size_t j = 0; j < group.num_colors; j++)
+              codes[j] |=
+                  ((word >> data_bit(layout.bits[group.colors[j]])) & 1)
+                  << bit;
+          }
+
+          for (size_t j = 0; j < group.num_colors; j++)
+            rgb[D::colors * i + group.colors[j]] =
+                decode_value<T, num_bits_value>(codes[j], num_bits);
+        }
+      }
+    }
+
+    /// fill planes[b] with the data bits in each bitplane at (addr, word),
+    /// for each bit b of a value of type T; see untranspose_words
+    template <typename T, size_t num_bits_value, typename Buffer>
+    void read_planes(Buffer &buf, size_t addr, size_t word, uint32_t *planes) {
+      constexpr uint32_t data_mask = (1u << D::data_bits) - 1;
+      for (size_t b = 0; b < sizeof(T) * 8; b++) planes[b] = 0;
+      for (size_t bit = 0; bit < num_bits; bit++) {
+        int value_bit = (int)bit + (num_bits_value - num_bits);
+        if (value_bit < 0) continue;
+
+        size_t idx = buf_idx(bit, addr, D::data_words - word);
+        planes[value_bit] = (read_word(buf, idx) >> data_bit(0)) & data_mask;
+      }
+    }
+
+    /// Read a whole image into rgb, as interleaved (r, g, b) values in
+    /// row-major order: the inverse of write_image, with the bitplane words
+    /// transposed back into values in batches (see untranspose_words).
+    template <typename T, size_t num_bits_value, typename Buffer>
+    void read_image(Buffer &buf, T *rgb) {
+      static const TransposeLayout<D> layout;
+      if (!layout.supported) {
+        for (size_t row = 0; row < D::rows; row++)
+          for (size_t col = 0; col < D::cols; col++) {
+            T *px = rgb + (row * D::cols + col) * D::colors;
+            read_rgb<T, num_bits_value>(buf, row, col, px[0], px[1], px[2]);
+          }
+        return;
+      }
+
+      untranspose_image<D>(
+          layout, rgb, [&](size_t addr, size_t word, uint32_t *planes) {
+            read_planes<T, num_bits_value>(buf, addr, word, planes);
+          });
+    }
   };
 
 }
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "driver.h"
+
+namespace DMAtrix {
+
+  /// Display driver for a canvas twice the height of Display, split into an
+  /// upper and lower half, each driven by its own DisplayDriver and pin
+  /// driver (e.g. I2S0 and I2S1 on the ESP32), doubling the output bandwidth.
+  ///
+  /// Both halves have the same buffer layout; they are started together with
+  /// start_together, and flipped together with flip_together, so that as
+  /// long as they run from the same clock, both refresh in lockstep and show
+  /// each frame at the same time.
+  ///
+  /// The two driver configs must select different devices.
+  template <typename Display, template <size_t, size_t> typename PinDriver,
+            bool double_buffered, bool framebuffered = false>
+  struct CompositeDisplayDriver {
+    using Part = DisplayDriver<Display, PinDriver, double_buffered,
+                               framebuffered>;
+    using PinsT = typename Part::PinsT;
+    using DriverConfig = typename Part::DriverConfig;
+
+    static constexpr size_t rows = 2 * Display::rows;
+    static constexpr size_t cols = Display::cols;
+
+    Part upper, lower;
+
+    CompositeDisplayDriver(PinsT upper_pins, PinsT lower_pins,
+                           size_t min_pulse, size_t num_bits,
+                           DriverConfig upper_config,
+                           DriverConfig lower_config)
+        : upper(upper_pins, min_pulse, num_bits, deferred(upper_config)),
+          lower(lower_pins, min_pulse, num_bits, deferred(lower_config)) {
+      start_together(upper.pin_driver, lower.pin_driver);
+    }
+
+    static DriverConfig deferred(DriverConfig config) {
+      config.autostart = false;
+      return config;
+    }
+
+    /// the part containing row, with row adjusted to be relative to it
+    Part &part(size_t &row) {
+      if (row < Display::rows) return upper;
+      row -= Display::rows;
+      return lower;
+    }
+
+    template <typename T = uint8_t, int num_bits_value = 8>
+    void write_rgb(size_t row, size_t col, T r, T g, T b) {
+      Part &p = part(row);
+      p.template write_rgb<T, num_bits_value>(row, col, r, g, b);
+    }
+
+    template <typename T = uint8_t, int num_bits_value = 8>
+    void hline(size_t row, size_t col, size_t len, T r, T g, T b) {
+      Part &p = part(row);
+      p.template hline<T, num_bits_value>(row, col, len, r, g, b);
+    }
+
+    template <typename T = uint8_t, int num_bits_value = 8>
+    void fill_rect(size_t row, size_t col, size_t height, size_t width, T r,
+                   T g, T b) {
+      for (size_t i = 0; i < height; i++)
+        hline<T, num_bits_value>(row + i, col, width, r, g, b);
+    }
+
+    template <typename T = uint8_t, int num_bits_value = 8>
+    void blit(size_t row, size_t col, size_t height, size_t width,
+              const T *rgb) {
+      for (size_t i = 0; i < height; i++) {
+        size_t part_row = row + i;
+        Part &p = part(part_row);
+        p.template blit<T, num_bits_value>(
+            part_row, col, 1, width, rgb + i * width * Display::colors);
+      }
+    }
+
+    /// write a whole image of rows x cols pixels
+    template <typename T = uint8_t, int num_bits_value = 8>
+    void write_image(const T *rgb) {
+      upper.template write_image<T, num_bits_value>(rgb);
+      lower.template write_image<T, num_bits_value>(
+          rgb + Display::rows * Display::cols * Display::colors);
+    }
+
+    void flip() {
+      upper.prepare_flip();
+      lower.prepare_flip();
+      if (double_buffered)
+        flip_together(upper.pin_driver, upper.back_buffer, lower.pin_driver,
+                      lower.back_buffer);
+      upper.flipped();
+      lower.flipped();
+    }
+
+    void blank(int clkspeed_hz = 0) {
+      upper.blank(clkspeed_hz);
+      lower.blank(clkspeed_hz);
+    }
+
+    void unblank() {
+      unblank_together(upper.pin_driver, lower.pin_driver);
+      upper.blanked = lower.blanked = false;
+    }
+
+    bool flip_done() {
+      // evaluate both, so that CopyForward syncs happen on each
+      bool upper_done = upper.flip_done();
+      bool lower_done = lower.flip_done();
+      return upper_done && lower_done;
+    }
+  };
+
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "text.h"
+
+namespace DMAtrix {
+
+  struct RGBA {
+    uint8_t r, g, b, a;
+  };
+
+  /// blend src over the 8 bit RGB pixel at dst
+  inline void blend(uint8_t *dst, RGBA src) {
+    if (src.a == 255) {
+      dst[0] = src.r;
+      dst[1] = src.g;
+      dst[2] = src.b;
+    } else if (src.a) {
+      unsigned int a = src.a, na = 255 - src.a;
+      dst[0] = (src.r * a + dst[0] * na + 127) / 255;
+      dst[1] = (src.g * a + dst[1] * na + 127) / 255;
+      dst[2] = (src.b * a + dst[2] * na + 127) / 255;
+    }
+  }
+
+  /// A layer in a Compositor, which draws one line at a time over the layers
+  /// below it.
+  struct Layer {
+    bool visible = true;
+
+    virtual ~Layer() {}
+
+    /// draw row of this layer over line, which has cols RGB pixels
+    virtual void compose_line(int row, uint8_t *line, size_t cols) = 0;
+
+    /// true if this layer covers every pixel of row with alpha 255, so that
+    /// layers below need not be drawn
+    virtual bool opaque_line(int row, size_t cols) { return false; }
+  };
+
+  /// a single color over the whole display
+  struct SolidLayer : Layer {
+    RGBA color;
+
+    SolidLayer(RGBA color) : color(color) {}
+
+    void compose_line(int row, uint8_t *line, size_t cols) override {
+      for (size_t col = 0; col < cols; col++) blend(line + 3 * col, color);
+    }
+
+    bool opaque_line(int row, size_t cols) override { return color.a == 255; }
+  };
+
+  /// an RGBA image of height rows and width columns, with its top left
+  /// corner at (row, col), which may be off the display
+  struct SpriteLayer : Layer {
+    const RGBA *pixels;
+    size_t height, width;
+    int row = 0, col = 0;
+
+    SpriteLayer(const RGBA *pixels, size_t height, size_t width)
+        : pixels(pixels), height(height), width(width) {}
+
+    void compose_line(int row, uint8_t *line, size_t cols) override {
+      int y = row - this->row;
+      if (y < 0 || y >= (int)height) return;
+
+      int start = std::max(col, 0);
+      int end = std::min(col + (int)width, (int)cols);
+      const RGBA *src = pixels + y * width;
+      for (int x = start; x < end; x++) blend(line + 3 * x, src[x - col]);
+    }
+  };
+
+  /// a line of text, with its top left corner at (row, col)
+  struct TextLayer : Layer {
+    Font font;
+    const char *text;
+    RGBA color;
+    int row = 0, col = 0;
+
+    TextLayer(const Font &font, const char *text, RGBA color)
+        : font(font), text(text), color(color) {}
+
+    void compose_line(int row, uint8_t *line, size_t cols) override {
+      int y = row - this->row;
+      if (y < 0 || y >= (int)font.height) return;
+
+      int x = col;
+      for (const char *c = text; *c && x < (int)cols; c++, x += font.width) {
+        unsigned char ch = *c;
+        if (ch < font.first || ch >= font.first + font.count) continue;
+        uint32_t bits = font.bitmap[(ch - font.first) * font.height + y];
+
+        for (int i = 0; i < (int)font.width; i++)
+          if (((bits >> i) & 1) && x + i >= 0 && x + i < (int)cols)
+            blend(line + 3 * (x + i), color);
+      }
+    }
+  };
+
+  /// Draws a stack of layers (in back to front order) into a display driver
+  /// one line at a time, so the only working memory needed is a line buffer.
+  /// Each line is written with DisplayDriver::blit, which writes it into the
+  /// data words of each bitplane in order.
+  template <typename D>
+  struct Compositor {
+    std::vector<Layer *> layers;
+    std::vector<uint8_t> line;
+
+    Compositor() : line(D::cols * 3) {}
+
+    /// compose row into line
+    void compose_line(int row) {
+      // skip everything below the top-most opaque layer
+      size_t first = 0;
+      for (size_t i = layers.size(); i-- > 0;)
+        if (layers[i]->visible && layers[i]->opaque_line(row, D::cols)) {
+          first = i;
+          break;
+        }
+      if (first == 0) std::fill(line.begin(), line.end(), 0);
+
+      for (size_t i = first; i < layers.size(); i++)
+        if (layers[i]->visible)
+          layers[i]->compose_line(row, line.data(), D::cols);
+    }
+
+    template <typename Driver>
+    void render(Driver &driver) {
+      for (size_t row = 0; row < D::rows; row++) {
+        compose_line(row);
+        driver.blit(row, 0, 1, D::cols, line.data());
+      }
+    }
+  };
+
+}
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "buffer_model.h"
+
+namespace DMAtrix {
+
+  /// Memory for COWBuffers on the host: plain malloc, and words in order.
+  struct HostMemory {
+    template <typename T>
+    static T *alloc(size_t len) {
+      return (T *)malloc(len * sizeof(T));
+    }
+    static void release(void *data) { free(data); }
+    template <typename T>
+    static size_t swizzle(size_t idx) {
+      return idx;
+    }
+  };
+
+  /// A pair of buffers split into segments, where each segment which is the
+  /// same in both buffers is stored once. The first write to a shared
+  /// segment through one buffer gives that buffer its own copy, and share()
+  /// drops the copies again, so the memory used beyond one buffer grows with
+  /// the segments which differ.
+  ///
+  /// Mem provides allocation and word order for the platform; see
+  /// HostMemory. If moved is set, it is called whenever a segment of a buffer
+  /// moves to different storage, so that DMA descriptors can follow it.
+  template <typename T, typename Mem = HostMemory>
+  struct COWBuffers {
+    using MovedFn = void (*)(void *arg, size_t buf, size_t segment, T *data);
+
+    // segment starts, followed by the size
+    std::vector<size_t> starts;
+    // storage for each segment of each buffer; shared segments have the
+    // same pointer in both
+    std::vector<T *> data[2];
+    // one buffer worth of storage, allocated up front
+    T *base = nullptr;
+    // number of segments with a separate copy
+    size_t copies = 0;
+
+    MovedFn moved = nullptr;
+    void *moved_arg = nullptr;
+
+    // segment of the last access, as accesses tend to be close together
+    size_t last = 0;
+
+    COWBuffers() = default;
+    COWBuffers(const COWBuffers &) = delete;
+
+    ~COWBuffers() {
+      // copies are never shared
+      for (size_t seg = 0; seg + 1 < starts.size(); seg++)
+        for (size_t buf = 0; buf < 2; buf++)
+          if (!in_base(data[buf][seg])) Mem::release(data[buf][seg]);
+      for (T *copy : retired) Mem::release(copy);
+      if (base) Mem::release(base);
+    }
+
+    void setup(size_t size, const std::vector<Segment> &segments) {
+      base = Mem::template alloc<T>(size);
+      assert(base);
+
+      starts.clear();
+      for (auto &segment : segments) starts.push_back(segment.start);
+      starts.push_back(size);
+
+      for (auto &buf_data : data) {
+        buf_data.clear();
+        for (size_t seg = 0; seg < num_segments(); seg++)
+          buf_data.push_back(base + starts[seg]);
+      }
+    }
+
+    size_t size() const { return starts.back(); }
+    size_t num_segments() const { return starts.size() - 1; }
+    size_t segment_len(size_t seg) const {
+      return starts[seg + 1] - starts[seg];
+    }
+    bool shared(size_t seg) const { return data[0][seg] == data[1][seg]; }
+    bool in_base(const T *p) const { return p >= base && p < base + size(); }
+
+    /// bytes used for copies, on top of the base buffer
+    size_t copy_bytes() const {
+      size_t res = 0;
+      for (size_t seg = 0; seg < num_segments(); seg++)
+        if (!shared(seg)) res += segment_len(seg) * sizeof(T);
+      return res;
+    }
+
+    size_t segment_of(size_t idx) {
+      if (idx < starts[last] || idx >= starts[last + 1])
+        last = std::upper_bound(starts.begin(), starts.end(), idx) -
+               starts.begin() - 1;
+      return last;
+    }
+
+    /// word idx of buf, for reading
+    const T &read(size_t buf, size_t idx) {
+      idx = Mem::template swizzle<T>(idx);
+      size_t seg = segment_of(idx);
+      return data[buf][seg][idx - starts[seg]];
+    }
+
+    /// word idx of buf, for writing; this copies the segment if it is
+    /// shared
+    T &write(size_t buf, size_t idx) {
+      idx = Mem::template swizzle<T>(idx);
+      size_t seg = segment_of(idx);
+      if (shared(seg)) {
+        T *copy = Mem::template alloc<T>(segment_len(seg));
+        assert(copy);
+        memcpy(copy, data[buf][seg], segment_len(seg) * sizeof(T));
+        set(buf, seg, copy);
+        copies++;
+      }
+      return data[buf][seg][idx - starts[seg]];
+    }
+
+    void set(size_t buf, size_t seg, T *p) {
+      data[buf][seg] = p;
+      if (moved) moved(moved_arg, buf, seg, p);
+    }
+
+    // copies moved out of by share, which the DMA may still be reading
+    std::vector<T *> retired;
+
+    /// Make dst the same as src by sharing every segment, dropping the
+    /// copies. Shared segments are always in the base buffer, so if src has
+    /// the copy, it is moved back there; this is safe while src is being
+    /// output, as the contents are the same, but its copy is only freed on
+    /// the next call, once the DMA has moved on.
+    void share(size_t dst, size_t src) {
+      for (T *copy : retired) Mem::release(copy);
+      retired.clear();
+
+      for (size_t seg = 0; seg < num_segments(); seg++) {
+        if (shared(seg)) continue;
+        T *in_place = base + starts[seg];
+
+        if (data[src][seg] != in_place) {
+          memcpy(in_place, data[src][seg], segment_len(seg) * sizeof(T));
+          retired.push_back(data[src][seg]);
+          set(src, seg, in_place);
+        } else {
+          Mem::release(data[dst][seg]);
+        }
+        set(dst, seg, in_place);
+        copies--;
+      }
+    }
+  };
+
+  /// one buffer of a COWBuffers, indexed like the buffers of other pin
+  /// drivers; every access is taken to be a write
+  template <typename T, typename Mem = HostMemory>
+  struct COWView {
+    COWBuffers<T, Mem> *pair;
+    size_t buf;
+
+    T &operator[](size_t idx) { return pair->write(buf, idx); }
+  };
+
+  /// the base buffer of a COWBuffers, indexed like a COWView, for writing
+  /// the contents of segments which are shared by both buffers
+  template <typename T, typename Mem = HostMemory>
+  struct COWBase {
+    COWBuffers<T, Mem> *pair;
+
+    T &operator[](size_t idx) {
+      return pair->base[Mem::template swizzle<T>(idx)];
+    }
+  };
+
+  /// write straight into the base buffer, which both buffers share until
+  /// the first write; see init_shared in buffer_model.h
+  template <typename T, typename Mem, typename Init>
+  bool init_shared(COWView<T, Mem> &view, Init init) {
+    assert(view.pair->copies == 0);
+    COWBase<T, Mem> base{view.pair};
+    init(base);
+    return true;
+  }
+
+  /// share rather than copy; see share_buffer in buffer_model.h
+  template <typename T, typename Mem>
+  bool share_buffer(COWView<T, Mem> &dst, COWView<T, Mem> &src) {
+    dst.pair->share(dst.buf, src.buf);
+    return true;
+  }
+
+  /// read without copying the segment; see read_word in buffer_model.h
+  template <typename T, typename Mem>
+  uint32_t read_word(COWView<T, Mem> &view, size_t idx) {
+    return view.pair->read(view.buf, idx);
+  }
+
+}
@@ -54,6 +54,59 @@ namespace DMAtrix {
     }
   };
 
+  /// Layout of a run of len pixels along a row starting at (row, col), for
+  /// drawing spans without encoding every pixel. Colors are grouped by the
+  /// words they occupy: pixel i of each color in a group is in word
+  /// (addr.word + i) of the plane for addr.addr, at data bit bits[color].
+  /// Colors which the display doesn't lay out like this have
+  /// contiguous[color] == false, and must be written pixel by pixel.
+  template <typename D>
+  struct SpanLayout {
+    struct Group {
+      DataAddr addr;
+      size_t num_colors = 0;
+      size_t colors[D::colors];
+    };
+
+    bool contiguous[D::colors];
+    size_t bits[D::colors];
+    Group groups[D::colors];
+    size_t num_groups = 0;
+
+    SpanLayout(size_t row, size_t col, size_t len) {
+      for (size_t color = 0; color < D::colors; color++) {
+        DataAddr start = D::encode(row, col, color);
+        bits[color] = start.bit;
+
+        contiguous[color] = len > 0;
+        for (size_t i = 1; i < len && contiguous[color]; i++) {
+          DataAddr addr = D::encode(row, col + i, color);
+          contiguous[color] = addr.addr == start.addr &&
+                              addr.bit == start.bit &&
+                              addr.word == start.word + i;
+        }
+        if (!contiguous[color]) continue;
+
+        size_t group = 0;
+        while (group < num_groups && !(groups[group].addr.addr == start.addr &&
+                                       groups[group].addr.word == start.word))
+          group++;
+        if (group == num_groups) groups[num_groups++].addr = start;
+
+        groups[group].colors[groups[group].num_colors++] = color;
+      }
+    }
+  };
+
+  /// the value of num_bits_value bits which a code read from num_bits
+  /// bitplanes stands for: the inverse of taking the top num_bits bits of the
+  /// value, with the bits below the lowest bitplane read as 0
+  template <typename T, size_t num_bits_value>
+  T decode_value(uint32_t code, size_t num_bits) {
+    return num_bits_value >= num_bits ? code << (num_bits_value - num_bits)
+                                      : code >> (num_bits - num_bits_value);
+  }
+
   template <typename D>
   struct Pins {
     size_t clk;
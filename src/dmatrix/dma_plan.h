@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace DMAtrix {
+
+  /// Where the DMA buffers and descriptors for a pin driver live, as found by
+  /// plan_dma.
+  struct DMAPlan {
+    enum class Strategy {
+      /// everything in one allocation
+      Arena,
+      /// descriptors in one allocation, and each buffer in another
+      PerBuffer,
+      /// descriptors in one allocation, and the segments of each buffer
+      /// spread over as few as possible, linked by the descriptors
+      Scattered,
+      /// not enough memory
+      Failed,
+    };
+
+    struct Chunk {
+      void *data;
+      size_t len;
+      // what is in the chunk: buffer (or SIZE_MAX for the descriptors), and
+      // the first and last segment
+      size_t buffer, first_segment, last_segment;
+    };
+
+    Strategy strategy = Strategy::Failed;
+    // bytes needed in total, excluding fragmentation
+    size_t required_bytes = 0;
+    std::vector<Chunk> chunks;
+    void *descriptors = nullptr;
+    // the start of each segment of each buffer
+    std::vector<std::vector<void *>> segments;
+
+    bool ok() const { return strategy != Strategy::Failed; }
+
+    size_t total_bytes() const {
+      size_t res = 0;
+      for (auto &chunk : chunks) res += chunk.len;
+      return res;
+    }
+
+    /// a human-readable description of the plan, for logging
+    std::string report() const {
+      static const char *names[] = {"arena", "per-buffer", "scattered",
+                                    "failed"};
+      char line[128];
+      snprintf(line, sizeof(line),
+               "DMA plan: %s, %u of %u bytes in %u chunks\n",
+               names[(int)strategy], (unsigned)total_bytes(),
+               (unsigned)required_bytes, (unsigned)chunks.size());
+      std::string res = line;
+
+      for (auto &chunk : chunks) {
+        if (chunk.buffer == SIZE_MAX)
+          snprintf(line, sizeof(line), "  %6u bytes: descriptors%s\n",
+                   (unsigned)chunk.len,
+                   strategy == Strategy::Arena ? " and all buffers" : "");
+        else
+          snprintf(line, sizeof(line),
+                   "  %6u bytes: buffer %u segments %u-%u\n",
+                   (unsigned)chunk.len, (unsigned)chunk.buffer,
+                   (unsigned)chunk.first_segment,
+                   (unsigned)chunk.last_segment);
+        res += line;
+      }
+      return res;
+    }
+  };
+
+  /// Allocate num_buffers buffers, split into segments of segment_bytes
+  /// each, and descriptor_bytes of descriptors, from mem, preferring one
+  /// arena, then one allocation per buffer, then scattering the segments over
+  /// whatever blocks are free. Every allocation is rounded up to 4 bytes.
+  ///
+  /// Memory provides alloc(bytes) (returning null on failure), release(ptr)
+  /// and largest_free(); see esp32::HeapMemory. On failure, nothing is left
+  /// allocated.
+  template <typename Memory>
+  DMAPlan plan_dma(Memory &mem, size_t num_buffers,
+                   const std::vector<size_t> &segment_bytes,
+                   size_t descriptor_bytes) {
+    auto round = [](size_t bytes) { return (bytes + 3) & ~(size_t)3; };
+    size_t num_segments = segment_bytes.size();
+    size_t buffer_bytes = 0;
+    for (size_t bytes : segment_bytes) buffer_bytes += round(bytes);
+    descriptor_bytes = round(descriptor_bytes);
+
+    DMAPlan plan;
+    plan.segments.assign(num_buffers, std::vector<void *>(num_segments));
+
+    auto release_all = [&] {
+      for (auto &chunk : plan.chunks) mem.release(chunk.data);
+      plan.chunks.clear();
+    };
+
+    // place the segments of buffer from start, returning the end
+    auto place = [&](size_t buffer, size_t first, size_t last,
+                     uint8_t *start) {
+      for (size_t seg = first; seg <= last; seg++) {
+        plan.segments[buffer][seg] = start;
+        start += round(segment_bytes[seg]);
+      }
+      return start;
+    };
+
+    // one arena
+    size_t arena_bytes = descriptor_bytes + num_buffers * buffer_bytes;
+    plan.required_bytes = arena_bytes;
+    if (uint8_t *arena = (uint8_t *)mem.alloc(arena_bytes)) {
+      plan.strategy = DMAPlan::Strategy::Arena;
+      plan.chunks.push_back({arena, arena_bytes, SIZE_MAX, 0, 0});
+      plan.descriptors = arena;
+      uint8_t *pos = arena + descriptor_bytes;
+      for (size_t buffer = 0; buffer < num_buffers; buffer++)
+        pos = place(buffer, 0, num_segments - 1, pos);
+      return plan;
+    }
+
+    plan.descriptors = mem.alloc(descriptor_bytes);
+    if (!plan.descriptors) return plan;
+    plan.chunks.push_back({plan.descriptors, descriptor_bytes, SIZE_MAX, 0, 0});
+
+    // one allocation per buffer
+    plan.strategy = DMAPlan::Strategy::PerBuffer;
+    for (size_t buffer = 0; buffer < num_buffers; buffer++) {
+      uint8_t *data = (uint8_t *)mem.alloc(buffer_bytes);
+      if (!data) {
+        plan.strategy = DMAPlan::Strategy::Scattered;
+        break;
+      }
+      plan.chunks.push_back(
+          {data, buffer_bytes, buffer, 0, num_segments - 1});
+      place(buffer, 0, num_segments - 1, data);
+    }
+    if (plan.strategy == DMAPlan::Strategy::PerBuffer) return plan;
+
+    // scatter: fill the largest free block with as many whole segments as fit,
+    // and repeat
+    while (plan.chunks.size() > 1) {
+      mem.release(plan.chunks.back().data);
+      plan.chunks.pop_back();
+    }
+    for (size_t buffer = 0; buffer < num_buffers; buffer++) {
+      for (size_t first = 0; first < num_segments;) {
+        size_t largest = mem.largest_free();
+        size_t last = first, bytes = round(segment_bytes[first]);
+        while (last + 1 < num_segments &&
+               bytes + round(segment_bytes[last + 1]) <= largest)
+          bytes += round(segment_bytes[++last]);
+
+        uint8_t *data = bytes <= largest ? (uint8_t *)mem.alloc(bytes)
+                                         : nullptr;
+        if (!data) {
+          release_all();
+          plan.descriptors = nullptr;
+          plan.strategy = DMAPlan::Strategy::Failed;
+          return plan;
+        }
+        plan.chunks.push_back({data, bytes, buffer, first, last});
+        place(buffer, first, last, data);
+        first = last + 1;
+      }
+    }
+    return plan;
+  }
+
+}
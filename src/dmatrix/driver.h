@@ -1,57 +1,347 @@
 #pragma once
 
 #include <array>
+#include <cassert>
 #include <type_traits>
 #include "buffer_model.h"
+#include "framebuffer.h"
+#include "text.h"
 
 namespace DMAtrix {
 
+  /// map from bits in the DMA output to the pins they should appear on
+  template <typename Display>
+  std::array<int, Pins<Display>::num_bits> data_pin_map(
+      const Pins<Display> &pins) {
+    using Model = BufferModel<Display>;
+    std::array<int, Pins<Display>::num_bits> data_pins;
+    data_pins[Model::oe_bit()] = pins.oe;
+    data_pins[Model::le_bit()] = pins.le;
+
+    for (size_t i = 0; i < Display::addr_bits; i++)
+      data_pins[Model::addr_bit(i)] = pins.addr[i];
+    for (size_t i = 0; i < Display::data_bits; i++)
+      data_pins[Model::data_bit(i)] = pins.data[i];
+
+    return data_pins;
+  }
+
+  /// start two pin drivers which were set up without autostart together;
+  /// platforms overload this to start them on the same clock cycle
+  template <typename PinDriver>
+  void start_together(PinDriver &a, PinDriver &b) {
+    a.start();
+    b.start();
+  }
+
+  /// unblank two pin drivers together, as for start_together
+  template <typename PinDriver>
+  void unblank_together(PinDriver &a, PinDriver &b) {
+    a.unblank();
+    b.unblank();
+  }
+
+  /// flip two pin drivers together; platforms overload this to make sure
+  /// that both flips take effect at the end of the same refresh
+  template <typename PinDriver>
+  void flip_together(PinDriver &a, size_t a_buf, PinDriver &b, size_t b_buf) {
+    a.flip_to(a_buf);
+    b.flip_to(b_buf);
+  }
+
+  enum class FlipMode {
+    /// the new back buffer holds the frame from two flips ago
+    Swap,
+    /// once the flip completes, the data in the new front buffer is copied to
+    /// the new back buffer, so that it can be drawn over incrementally; with
+    /// copy-on-write buffers, the back buffer shares the front buffer's
+    /// storage instead (see COWBuffers)
+    CopyForward,
+  };
+
+  /// If framebuffered is set, pixels are written to a compact
+  /// BitplaneFramebuffer rather than the DMA buffer, and copied into the back
+  /// buffer on flip. This makes drawing cheaper at the cost of a copy per
+  /// frame, and the framebuffer keeps its contents between flips.
+  ///
+  /// Model generates the waveform: BufferModel for panels with plain shift
+  /// registers, or SPWMBufferModel for panels with S-PWM driver chips.
   template <typename Display, template <size_t, size_t> typename PinDriver,
-            bool double_buffered>
+            bool double_buffered, bool framebuffered = false,
+            template <typename> typename Model = BufferModel>
   struct DisplayDriver {
     using PinsT = Pins<Display>;
     static constexpr size_t num_buffers = double_buffered ? 2 : 1;
+    static constexpr bool uses_framebuffer = framebuffered;
     size_t back_buffer = double_buffered ? 1 : 0;
 
     using PinDriverT = PinDriver<PinsT::num_bits, num_buffers>;
     using DriverConfig = typename PinDriverT::Config;
     PinDriverT pin_driver;
 
-    BufferModel<Display> buffer_model;
+    Model<Display> buffer_model;
+    BitplaneFramebuffer<Display> framebuffer;
 
+    FlipMode flip_mode = FlipMode::Swap;
+    // a flip is pending in CopyForward mode, and the back buffer must be
+    // synced when it completes
+    bool sync_pending = false;
+
+    // Switch to the new frame at the next flip point rather than the end of
+    // the buffer (if the pin driver supports it). The refresh in which the
+    // switch happens shows some subframes from each frame, so pixels which
+    // change are briefly a mix of their old and new values.
+    bool low_latency_flip = false;
+
+    // Without double buffering, copy the framebuffer into the DMA buffer
+    // behind the DMA read position on flip, so that the new frame appears
+    // all at once (see BufferModel::write_frame_behind). flip then takes up
+    // to a refresh (two with SPWMBufferModel). Only valid if
+    // can_race_beam(); flip asserts this. While blanked, the frame is written
+    // at once.
+    bool race_beam = false;
+
+    // the number of DMA segments per buffer, and whether the display is
+    // blanked
+    size_t num_segments = 0;
+    bool blanked = false;
+
+    /// min_buf_len pads the buffer to fix the refresh rate; see
+    /// solve_refresh_rate
     DisplayDriver(PinsT pins, size_t min_pulse, size_t num_bits,
-                  DriverConfig driver_config = {})
-        : buffer_model(min_pulse, num_bits) {
-      std::array<int, PinsT::num_bits> data_pins;
-      data_pins[buffer_model.oe_bit()] = pins.oe;
-      data_pins[buffer_model.le_bit()] = pins.le;
+                  DriverConfig driver_config = {}, size_t min_buf_len = 0)
+        : buffer_model(min_pulse, num_bits, min_buf_len),
+          framebuffer(framebuffered ? num_bits : 0) {
+      setup(pins, driver_config);
+    }
 
-      for (size_t i = 0; i < Display::addr_bits; i++)
-        data_pins[buffer_model.addr_bit(i)] = pins.addr[i];
-      for (size_t i = 0; i < Display::data_bits; i++)
-        data_pins[buffer_model.data_bit(i)] = pins.data[i];
+    /// bitplane bit is shown for weights[bit] clocks; see gamma_codes
+    DisplayDriver(PinsT pins, const std::vector<size_t> &weights,
+                  DriverConfig driver_config = {}, size_t min_buf_len = 0)
+        : buffer_model(weights, min_buf_len),
+          framebuffer(framebuffered ? weights.size() : 0) {
+      setup(pins, driver_config);
+    }
 
-      pin_driver.setup(data_pins, pins.clk, driver_config,
-                       buffer_model.buf_len);
+    void setup(PinsT pins, DriverConfig driver_config) {
+      std::vector<Segment> segments =
+          buffer_model.segments(PinDriverT::max_segment_len(driver_config),
+                                PinDriverT::segment_align);
+      num_segments = segments.size();
+      pin_driver.setup(data_pin_map(pins), pins.clk, driver_config,
+                       buffer_model.buf_len, segments);
 
-      for (size_t i = 0; i < num_buffers; i++)
-        buffer_model.init_buffer(pin_driver.buffers[i]);
+      // the buffers start out the same
+      auto init = [&](auto &buf) { buffer_model.init_buffer(buf); };
+      if (!init_shared(pin_driver.buffers[0], init))
+        for (size_t i = 1; i < num_buffers; i++) init(pin_driver.buffers[i]);
     }
 
     template <typename T = uint8_t, int num_bits_value = 8>
     void write_rgb(size_t row, size_t col, T r, T g, T b) {
-      buffer_model.template write_rgb<T, num_bits_value>(
-          pin_driver.buffers[back_buffer], row, col, r, g, b);
+      if (framebuffered)
+        framebuffer.template write_rgb<T, num_bits_value>(row, col, r, g, b);
+      else
+        buffer_model.template write_rgb<T, num_bits_value>(
+            pin_driver.buffers[back_buffer], row, col, r, g, b);
     }
 
-    void flip() {
+    /// draw a horizontal line of len pixels starting at (row, col)
+    template <typename T = uint8_t, int num_bits_value = 8>
+    void hline(size_t row, size_t col, size_t len, T r, T g, T b) {
+      if (framebuffered)
+        framebuffer.template fill_span<T, num_bits_value>(row, col, len, r, g,
+                                                          b);
+      else
+        buffer_model.template fill_span<T, num_bits_value>(
+            pin_driver.buffers[back_buffer], row, col, len, r, g, b);
+    }
+
+    /// draw a vertical line of len pixels starting at (row, col)
+    template <typename T = uint8_t, int num_bits_value = 8>
+    void vline(size_t row, size_t col, size_t len, T r, T g, T b) {
+      for (size_t i = 0; i < len; i++)
+        hline<T, num_bits_value>(row + i, col, 1, r, g, b);
+    }
+
+    /// fill a rectangle of height rows and width columns, with the top left
+    /// corner at (row, col)
+    template <typename T = uint8_t, int num_bits_value = 8>
+    void fill_rect(size_t row, size_t col, size_t height, size_t width, T r,
+                   T g, T b) {
+      for (size_t i = 0; i < height; i++)
+        hline<T, num_bits_value>(row + i, col, width, r, g, b);
+    }
+
+    /// copy an image of height rows and width columns to (row, col); rgb
+    /// contains interleaved (r, g, b) triples in row-major order
+    template <typename T = uint8_t, int num_bits_value = 8>
+    void blit(size_t row, size_t col, size_t height, size_t width,
+              const T *rgb) {
+      for (size_t i = 0; i < height; i++) {
+        const T *line = rgb + i * width * Display::colors;
+        if (framebuffered)
+          framebuffer.template write_span<T, num_bits_value>(row + i, col,
+                                                             width, line);
+        else
+          buffer_model.template write_span<T, num_bits_value>(
+              pin_driver.buffers[back_buffer], row + i, col, width, line);
+      }
+    }
+
+    /// write a whole image; rgb holds interleaved (r, g, b) values in
+    /// row-major order
+    template <typename T = uint8_t, int num_bits_value = 8>
+    void write_image(const T *rgb) {
+      if (framebuffered)
+        framebuffer.template write_image<T, num_bits_value>(rgb);
+      else
+        buffer_model.template write_image<T, num_bits_value>(
+            pin_driver.buffers[back_buffer], rgb);
+    }
+
+    /// Read back a pixel, as written by write_rgb; bits of the value below
+    /// the lowest bitplane read as 0. Without a framebuffer this reads the
+    /// back buffer, which in FlipMode::Swap holds the frame before last, so
+    /// use FlipMode::CopyForward for read-modify-write effects.
+    template <typename T = uint8_t, int num_bits_value = 8>
+    void read_rgb(size_t row, size_t col, T &r, T &g, T &b) {
+      if (framebuffered)
+        framebuffer.template read_rgb<T, num_bits_value>(row, col, r, g, b);
+      else
+        buffer_model.template read_rgb<T, num_bits_value>(
+            pin_driver.buffers[back_buffer], row, col, r, g, b);
+    }
+
+    /// read len pixels starting at (row, col) into rgb, as interleaved
+    /// (r, g, b) triples; see read_rgb
+    template <typename T = uint8_t, int num_bits_value = 8>
+    void read_span(size_t row, size_t col, size_t len, T *rgb) {
+      if (framebuffered)
+        framebuffer.template read_span<T, num_bits_value>(row, col, len, rgb);
+      else
+        buffer_model.template read_span<T, num_bits_value>(
+            pin_driver.buffers[back_buffer], row, col, len, rgb);
+    }
+
+    /// read a whole image into rgb, in the layout taken by write_image; see
+    /// read_rgb
+    template <typename T = uint8_t, int num_bits_value = 8>
+    void read_image(T *rgb) {
+      if (framebuffered)
+        framebuffer.template read_image<T, num_bits_value>(rgb);
+      else
+        buffer_model.template read_image<T, num_bits_value>(
+            pin_driver.buffers[back_buffer], rgb);
+    }
+
+    /// draw text using the font and color in cache, returning the column
+    /// after the last character
+    int draw_text(GlyphCache<Display> &cache, int row, int col,
+                  const char *text) {
+      // for rows which aren't contiguous
+      auto pixel = [&](size_t row, size_t col, uint16_t r, uint16_t g,
+                       uint16_t b) {
+        write_rgb<uint16_t, 16>(row, col, r, g, b);
+      };
+      if (framebuffered)
+        return cache.draw_text(row, col, text,
+                               [&](size_t bit, size_t addr, size_t word,
+                                   size_t len, uint32_t clear, uint32_t set) {
+                                 framebuffer.update_words(bit, addr, word, len,
+                                                          clear, set);
+                               },
+                               pixel);
+      else
+        return cache.draw_text(
+            row, col, text,
+            [&](size_t bit, size_t addr, size_t word, size_t len,
+                uint32_t clear, uint32_t set) {
+              buffer_model.update_words(pin_driver.buffers[back_buffer], bit,
+                                        addr, word, len,
+                                        clear << buffer_model.data_bit(0),
+                                        set << buffer_model.data_bit(0));
+            },
+            pixel);
+    }
+
+    /// show the back buffer, returning a sequence number which can be passed
+    /// to flip_done(seq)
+    uint32_t flip() {
+      prepare_flip();
+      uint32_t seq =
+          double_buffered ? pin_driver.flip_to(back_buffer, low_latency_flip)
+                          : 0;
+      flipped();
+      return seq;
+    }
+
+    /// Turn the display off without touching the buffers, by switching the
+    /// DMA to a short loop of blank words (with OE high), output at
+    /// clkspeed_hz if given to save power and memory bandwidth.
+    void blank(int clkspeed_hz = 0) {
+      pin_driver.blank(Model<Display>::blank_word(), clkspeed_hz);
+      blanked = true;
+    }
+
+    /// resume showing the front buffer, from the start of a refresh
+    void unblank() {
+      pin_driver.unblank();
+      blanked = false;
+    }
+
+    /// Whether race_beam can be used: it needs a framebuffer, a single
+    /// buffer, and at least two segments, as the read position is the start
+    /// of the segment being output, and otherwise never moves.
+    bool can_race_beam() const {
+      return framebuffered && !double_buffered && num_segments > 1;
+    }
+
+    /// the first part of flip: get the back buffer ready to be shown
+    void prepare_flip() {
+      assert(!race_beam || can_race_beam());
+      if (framebuffered) {
+        if (race_beam && can_race_beam() && !blanked)
+          buffer_model.write_frame_behind(
+              pin_driver.buffers[back_buffer], framebuffer,
+              [&] { return pin_driver.read_position(); });
+        else
+          buffer_model.write_frame(pin_driver.buffers[back_buffer],
+                                   framebuffer);
+      }
+    }
+
+    /// the last part of flip, once the pin driver has been flipped to
+    /// back_buffer
+    void flipped() {
       if (double_buffered) {
-        pin_driver.flip_to(back_buffer);
         back_buffer ^= 1;
+        sync_pending = flip_mode == FlipMode::CopyForward;
       }
     }
 
-    bool flip_done() { return double_buffered ? pin_driver.flip_done() : true; }
+    /// check if flip seq has completed; unlike flip_done(), this doesn't sync
+    /// the back buffer in CopyForward mode
+    bool flip_done(uint32_t seq) {
+      return !double_buffered || pin_driver.flip_done(seq);
+    }
+
+    /// check if the last flip has completed, after which the back buffer may
+    /// be drawn to; in CopyForward mode, the first call after completion
+    /// copies the front buffer data to the back buffer
+    bool flip_done() {
+      if (!double_buffered) return true;
+      if (!pin_driver.flip_done()) return false;
+
+      if (sync_pending) {
+        if (!share_buffer(pin_driver.buffers[back_buffer],
+                          pin_driver.buffers[back_buffer ^ 1]))
+          buffer_model.copy_data(pin_driver.buffers[back_buffer],
+                                 pin_driver.buffers[back_buffer ^ 1]);
+        sync_pending = false;
+      }
+      return true;
+    }
   };
 
 }
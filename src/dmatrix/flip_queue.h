@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace DMAtrix {
+
+  /// Bookkeeping for flips, shared between a DMA pin driver (which requests
+  /// flips) and its end-of-buffer interrupt (which reports which buffer the
+  /// DMA moved on to).
+  ///
+  /// Each flip gets a sequence number, and is complete once the DMA has
+  /// started outputting its buffer, as observed by the interrupt rather than
+  /// inferred from the interrupt firing. Flips requested while others are
+  /// pending are chained, with each buffer linked to the next, so each buffer
+  /// is shown for at least one refresh. Flipping to the front buffer or one
+  /// already queued relinks that buffer to itself, which cancels the flips
+  /// queued after it; they complete along with the new flip, as their
+  /// buffers will not be shown.
+  ///
+  /// flip_to runs in one thread, and started in the interrupt. Only the
+  /// latest sequence number for each buffer is kept, and it is published
+  /// before the DMA can reach the buffer, so no locking is needed.
+  template <size_t num_buffers>
+  struct FlipQueue {
+    // the sequence number of the last flip to each buffer
+    volatile uint32_t seqs[num_buffers] = {0};
+
+    // the sequence number of the last flip requested, and of the last flip
+    // whose buffer has started (or which was cancelled)
+    volatile uint32_t requested = 0;
+    volatile uint32_t completed = 0;
+
+    // the buffer being output, and the last buffer flipped to (or the front
+    // buffer), which is linked to itself
+    volatile size_t front = 0;
+    size_t last = 0;
+
+    /// Queue a flip to buffer, returning its sequence number. link(from, to)
+    /// is called to point the end of buffer from at buffer to.
+    template <typename Link>
+    uint32_t flip_to(size_t buffer, Link link) {
+      uint32_t seq = requested + 1;
+      requested = seq;
+
+      seqs[buffer] = seq;
+      link(buffer, buffer);
+      link(last, buffer);
+      last = buffer;
+
+      return seq;
+    }
+
+    /// call from the interrupt when the DMA starts outputting buffer; this
+    /// completes every flip up to the last one to buffer
+    void started(size_t buffer) {
+      front = buffer;
+      uint32_t seq = seqs[buffer];
+      if ((int32_t)(seq - completed) > 0) completed = seq;
+    }
+
+    /// forget any pending flips, after the DMA has been restarted on buffer
+    void reset(size_t buffer) {
+      completed = requested;
+      front = last = buffer;
+    }
+
+    /// true if flip seq has completed
+    bool done(uint32_t seq) const { return (int32_t)(completed - seq) >= 0; }
+
+    /// true if every flip requested has completed
+    bool done() const { return done(requested); }
+  };
+
+}
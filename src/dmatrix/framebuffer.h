@@ -0,0 +1,286 @@
+#pragma once
+
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+#include "display_model.h"
+#include "transpose.h"
+
+namespace DMAtrix {
+
+  /// A compact image store holding only the data bits of the waveform: one
+  /// plane per (bit, addr) pair, each containing data_words words. Word w of a
+  /// plane holds the data bits (in data line order) which are on the outputs w
+  /// words before LE, so a plane maps onto the data region of a subframe with
+  /// a single shift.
+  template <typename D>
+  struct BitplaneFramebuffer {
+    using word_t = std::conditional_t<
+        D::data_bits <= 8, uint8_t,
+        std::conditional_t<D::data_bits <= 16, uint16_t, uint32_t>>;
+
+    size_t num_bits;
+    std::vector<word_t> planes;
+
+    BitplaneFramebuffer(size_t num_bits)
+        : num_bits(num_bits),
+          planes((num_bits << D::addr_bits) * D::data_words) {}
+
+    word_t *plane(size_t bit, size_t addr) {
+      return &planes[((bit << D::addr_bits) + addr) * D::data_words];
+    }
+
+    const word_t *plane(size_t bit, size_t addr) const {
+      return &planes[((bit << D::addr_bits) + addr) * D::data_words];
+    }
+
+    void clear() { std::fill(planes.begin(), planes.end(), 0); }
+
+    /// the number of bitplanes up to and including the highest with any bit
+    /// set, scanning down from the top so that dim frames are quick
+    size_t used_bits() const {
+      size_t plane_len = D::data_words << D::addr_bits;
+      for (size_t bit = num_bits; bit > 0; bit--) {
+        const word_t *start = &planes[(bit - 1) * plane_len];
+        if (std::any_of(start, start + plane_len,
+                        [](word_t word) { return word != 0; }))
+          return bit;
+      }
+      return 0;
+    }
+
+    template <typename T, size_t num_bits_value>
+    void write_color(size_t row, size_t col, size_t color, T value) {
+      DataAddr addr = D::encode(row, col, color);
+
+      // branch-free when every bitplane takes a bit of value; see
+      // BufferModel::write_color
+      if (num_bits_value >= num_bits) {
+        uint32_t v = (uint32_t)value >> (num_bits_value - num_bits);
+        word_t mask = 1 << addr.bit;
+
+        for (size_t bit = 0; bit < num_bits; bit++) {
+          word_t &word = plane(bit, addr.addr)[addr.word];
+          word_t set = -((v >> bit) & 1) & mask;
+          word = (word & ~mask) | set;
+        }
+        return;
+      }
+
+      for (size_t bit = 0; bit < num_bits; bit++) {
+        int value_bit = (int)bit + (num_bits_value - num_bits);
+        word_t &word = plane(bit, addr.addr)[addr.word];
+
+        if (value_bit >= 0 && ((value >> value_bit) & 1))
+          word |= 1 << addr.bit;
+        else
+          word &= ~(1 << addr.bit);
+      }
+    }
+
+    /// apply (x & ~clear) | set to words [word, word + len) of the plane for
+    /// (bit, addr)
+    void update_words(size_t bit, size_t addr, size_t word, size_t len,
+                      word_t clear, word_t set) {
+      word_t *words = plane(bit, addr) + word;
+      for (size_t i = 0; i < len; i++) words[i] = (words[i] & ~clear) | set;
+    }
+
+    /// set len pixels along a row starting at (row, col) to one color; see
+    /// BufferModel::fill_span
+    template <typename T, size_t num_bits_value>
+    void fill_span(size_t row, size_t col, size_t len, T r, T g, T b) {
+      T values[D::colors] = {r, g, b};
+      SpanLayout<D> layout(row, col, len);
+
+      for (size_t color = 0; color < D::colors; color++)
+        if (!layout.contiguous[color])
+          for (size_t i = 0; i < len; i++)
+            write_color<T, num_bits_value>(row, col + i, color, values[color]);
+
+      for (size_t group_idx = 0; group_idx < layout.num_groups; group_idx++) {
+        auto &group = layout.groups[group_idx];
+
+        word_t clear = 0;
+        for (size_t i = 0; i < group.num_colors; i++)
+          clear |= 1 << layout.bits[group.colors[i]];
+
+        for (size_t bit = 0; bit < num_bits; bit++) {
+          int value_bit = (int)bit + (num_bits_value - num_bits);
+
+          word_t set = 0;
+          for (size_t i = 0; value_bit >= 0 && i < group.num_colors; i++) {
+            size_t color = group.colors[i];
+            if ((values[color] >> value_bit) & 1)
+              set |= 1 << layout.bits[color];
+          }
+
+          update_words(bit, group.addr.addr, group.addr.word, len, clear, set);
+        }
+      }
+    }
+
+    /// write len pixels along a row starting at (row, col), from rgb, which
+    /// contains len interleaved (r, g, b) triples
+    template <typename T, size_t num_bits_value>
+    void write_span(size_t row, size_t col, size_t len, const T *rgb) {
+      SpanLayout<D> layout(row, col, len);
+
+      for (size_t color = 0; color < D::colors; color++)
+        if (!layout.contiguous[color])
+          for (size_t i = 0; i < len; i++)
+            write_color<T, num_bits_value>(row, col + i, color,
+                                           rgb[D::colors * i + color]);
+
+      for (size_t group_idx = 0; group_idx < layout.num_groups; group_idx++) {
+        auto &group = layout.groups[group_idx];
+
+        word_t clear = 0;
+        for (size_t i = 0; i < group.num_colors; i++)
+          clear |= 1 << layout.bits[group.colors[i]];
+
+        for (size_t bit = 0; bit < num_bits; bit++) {
+          int value_bit = (int)bit + (num_bits_value - num_bits);
+          word_t *words = plane(bit, group.addr.addr) + group.addr.word;
+
+          for (size_t i = 0; i < len; i++) {
+            word_t set = 0;
+            for (size_t j = 0; value_bit >= 0 && j < group.num_colors; j++) {
+              size_t color = group.colors[j];
+              set |= ((rgb[D::colors * i + color] >> value_bit) & 1)
+                     << layout.bits[color];
+            }
+            words[i] = (words[i] & ~clear) | set;
+          }
+        }
+      }
+    }
+
+    /// write a whole image; see BufferModel::write_image
+    template <typename T, size_t num_bits_value,
+              typename Kernel = TransposeBest>
+    void write_image(const T *rgb) {
+      static const TransposeLayout<D> layout;
+      if (!layout.supported) {
+        for (size_t row = 0; row < D::rows; row++)
+          for (size_t col = 0; col < D::cols; col++) {
+            const T *px = rgb + (row * D::cols + col) * D::colors;
+            write_rgb<T, num_bits_value>(row, col, px[0], px[1], px[2]);
+          }
+        return;
+      }
+
+      transpose_image<D, Kernel>(
+          layout, rgb, [&](size_t addr, size_t word, const uint32_t *planes) {
+            for (size_t bit = 0; bit < num_bits; bit++) {
+              int value_bit = (int)bit + (num_bits_value - num_bits);
+              plane(bit, addr)[word] = value_bit >= 0 ? planes[value_bit] : 0;
+            }
+          });
+    }
+
+    template <typename T, size_t num_bits_value>
+    void write_rgb(size_t row, size_t col, T r, T g, T b) {
+      write_color<T, num_bits_value>(row, col, 0, r);
+      write_color<T, num_bits_value>(row, col, 1, g);
+      write_color<T, num_bits_value>(row, col, 2, b);
+    }
+
+    /// read back one color of a pixel; see BufferModel::read_color
+    template <typename T, size_t num_bits_value>
+    T read_color(size_t row, size_t col, size_t color) const {
+      DataAddr addr = D::encode(row, col, color);
+      uint32_t code = 0;
+      for (size_t bit = 0; bit < num_bits; bit++)
+        code |= ((plane(bit, addr.addr)[addr.word] >> addr.bit) & 1) << bit;
+      return decode_value<T, num_bits_value>(code, num_bits);
+    }
+
+    template <typename T, size_t num_bits_value>
+    void read_rgb(size_t row, size_t col, T &r, T &g, T &b) const {
+      r = read_color<T, num_bits_value>(row, col, 0);
+      g = read_color<T, num_bits_value>(row, col, 1);
+      b = read_color<T, num_bits_value>(row, col, 2);
+    }
+
+    /// read len pixels along a row starting at (row, col) into rgb; see
+    /// BufferModel::read_span
+    template <typename T, size_t num_bits_value>
+    void read_span(size_t row, size_t col, size_t len, T *rgb) const {
+      static const TransposeLayout<D> transpose_layout;
+      if (transpose_layout.supported) {
+        size_t addr = D::encode(row, col, 0).addr;
+        size_t lines[D::colors];
+        for (size_t color = 0; color < D::colors; color++)
+          lines[color] = D::encode(row, col, color).bit;
+
+        untranspose_words<D, T>(
+            col, col + len,
+            [&](size_t word, uint32_t *planes) {
+              read_planes<T, num_bits_value>(addr, word, planes);
+            },
+            [&](size_t word, const uint32_t *values) {
+              T *px = rgb + (word - col) * D::colors;
+              for (size_t color = 0; color < D::colors; color++)
+                px[color] = (T)values[lines[color]];
+            });
+        return;
+      }
+
+      SpanLayout<D> layout(row, col, len);
+
+      for (size_t color = 0; color < D::colors; color++)
+        if (!layout.contiguous[color])
+          for (size_t i = 0; i < len; i++)
+            rgb[D::colors * i + color] =
+                read_color<T, num_bits_value>(row, col + i, color);
+
+      for (size_t group_idx = 0; group_idx < layout.num_groups; group_idx++) {
+        auto &group = layout.groups[group_idx];
+
+        for (size_t i = 0; i < len; i++) {
+          uint32_t codes[D::colors] = {0};
+          for (size_t bit = 0; bit < num_bits; bit++) {
+            word_t word = plane(bit, group.addr.addr)[group.addr.word + i];
+            for (size_t j = 0; j < group.num_colors; j++)
+              codes[j] |= ((word >> layout.bits[group.colors[j]]) & 1) << bit;
+          }
+
+          for (size_t j = 0; j < group.num_colors; j++)
+            rgb[D::colors * i + group.colors[j]] =
+                decode_value<T, num_bits_value>(codes[j], num_bits);
+        }
+      }
+    }
+
+    /// see BufferModel::read_planes
+    template <typename T, size_t num_bits_value>
+    void read_planes(size_t addr, size_t word, uint32_t *planes) const {
+      for (size_t b = 0; b < sizeof(T) * 8; b++) planes[b] = 0;
+      for (size_t bit = 0; bit < num_bits; bit++) {
+        int value_bit = (int)bit + (num_bits_value - num_bits);
+        if (value_bit >= 0) planes[value_bit] = plane(bit, addr)[word];
+      }
+    }
+
+    /// read a whole image; see BufferModel::read_image
+    template <typename T, size_t num_bits_value>
+    void read_image(T *rgb) const {
+      static const TransposeLayout<D> layout;
+      if (!layout.supported) {
+        for (size_t row = 0; row < D::rows; row++)
+          for (size_t col = 0; col < D::cols; col++) {
+            T *px = rgb + (row * D::cols + col) * D::colors;
+            read_rgb<T, num_bits_value>(row, col, px[0], px[1], px[2]);
+          }
+        return;
+      }
+
+      untranspose_image<D>(
+          layout, rgb, [&](size_t addr, size_t word, uint32_t *planes) {
+            read_planes<T, num_bits_value>(addr, word, planes);
+          });
+    }
+  };
+
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace DMAtrix {
+
+  /// the brightness of code with the given bitplane weights
+  inline size_t code_brightness(const std::vector<size_t> &weights,
+                                uint32_t code) {
+    size_t res = 0;
+    for (size_t bit = 0; bit < weights.size(); bit++)
+      if ((code >> bit) & 1) res += weights[bit];
+    return res;
+  }
+
+  /// the number of distinct brightness levels in a table from gamma_codes
+  inline size_t distinct_levels(const std::vector<size_t> &weights,
+                                const std::vector<uint16_t> &codes) {
+    size_t res = 1;
+    for (size_t v = 1; v < codes.size(); v++)
+      res += code_brightness(weights, codes[v]) !=
+             code_brightness(weights, codes[v - 1]);
+    return res;
+  }
+
+  /// Build a table from input values of input_bits to codes for a
+  /// BufferModel with the given weights: each input v gets the code whose
+  /// brightness is closest to (v / max)^gamma of the brightest, so the curve
+  /// is realised in the timing, rather than by discarding low codes. The
+  /// brightness of the codes increases with v.
+  inline std::vector<uint16_t> gamma_codes(const std::vector<size_t> &weights,
+                                           double gamma = 2.2,
+                                           size_t input_bits = 8) {
+    size_t num_bits = weights.size();
+    assert(num_bits <= 16);
+
+    // the lowest code for each distinct brightness, in order
+    std::vector<std::pair<size_t, uint16_t>> levels;
+    for (uint32_t code = 0; code < (1u << num_bits); code++)
+      levels.push_back({code_brightness(weights, code), (uint16_t)code});
+    std::sort(levels.begin(), levels.end());
+    levels.erase(std::unique(levels.begin(), levels.end(),
+                             [](const std::pair<size_t, uint16_t> &a,
+                                const std::pair<size_t, uint16_t> &b) {
+                               return a.first == b.first;
+                             }),
+                 levels.end());
+
+    size_t max_input = (1 << input_bits) - 1;
+    double max_brightness = (double)levels.back().first;
+
+    std::vector<uint16_t> res;
+    for (size_t v = 0; v <= max_input; v++) {
+      double target = max_brightness * std::pow((double)v / max_input, gamma);
+      auto it = std::lower_bound(
+          levels.begin(), levels.end(), target,
+          [](const std::pair<size_t, uint16_t> &level, double target) {
+            return level.first < target;
+          });
+      if (it == levels.end() ||
+          (it != levels.begin() &&
+           target - (it - 1)->first < it->first - target))
+        --it;
+      res.push_back(it->second);
+    }
+    return res;
+  }
+
+}
@@ -4,16 +4,46 @@
 #include <driver/periph_ctrl.h>
 #include <esp_heap_caps.h>
 #include <esp_intr_alloc.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 #include <rom/gpio.h>
 #include <rom/lldesc.h>
 #include <soc/gpio_periph.h>
 #include <soc/gpio_sig_map.h>
 #include <soc/i2s_reg.h>
 #include <soc/i2s_struct.h>
+#include <xtensa/core-macros.h>
+#include <algorithm>
 #include <array>
+#include <cstring>
+#include <vector>
+#include "../buffer_model.h"
+#include "../cow_buffer.h"
+#include "../dma_plan.h"
+#include "../flip_queue.h"
+#include "../loop_chain.h"
+#include "../refresh_rate.h"
 
 namespace DMAtrix {
 
+  struct ESP32Config {
+    size_t dev = 0;
+    int clkspeed_hz = 20000000;
+    // if set, used instead of clkspeed_hz to give an exact clock rate
+    ClockDivider divider;
+    // start DMA in setup; otherwise call start (or start_together)
+    bool autostart = true;
+    // maximum DMA descriptor length in words, or 0 for the largest possible;
+    // shorter descriptors give lower latency flips (see BufferModel::segments)
+    size_t segment_len = 0;
+    // interrupt at every flip point rather than just the end of each buffer,
+    // so that low latency flips are reported as done promptly
+    bool low_latency_flips = false;
+    // only enable the end-of-buffer interrupt while a flip is pending,
+    // rather than on every refresh
+    bool eof_on_demand = false;
+  };
+
   namespace esp32 {
 
     const size_t DMA_MAX = 4096 - 4;
@@ -60,20 +90,35 @@ namespace DMAtrix {
 
     template <typename T>
     struct DMABuffer {
+      // null if the buffer is scattered over several allocations (see
+      // plan_dma), in which case words are found through seg_data
       T *buf = nullptr;
+      size_t size;
       size_t desccount;
       lldesc_t *dmadesc;
 
+      // segment starts, followed by the size, and the storage for each
+      // segment
+      std::vector<size_t> starts;
+      std::vector<T *> seg_data;
+      // segment of the last scattered access
+      size_t last = 0;
+
       T &operator[](size_t idx) {
         if (std::is_same<T, uint8_t>::value)
-          return buf[idx ^ 2];
+          idx ^= 2;
         else if (std::is_same<T, uint16_t>::value)
-          return buf[idx ^ 1];
-        else
-          return buf[idx];
+          idx ^= 1;
+        if (buf) return buf[idx];
+
+        if (idx < starts[last] || idx >= starts[last + 1])
+          last = std::upper_bound(starts.begin(), starts.end(), idx) -
+                 starts.begin() - 1;
+        return seg_data[last][idx - starts[last]];
       }
 
       void setup(size_t size) {
+        this->size = size;
         buf = (T *)heap_caps_malloc(sizeof(T) * size, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA);
         assert(buf);
 
@@ -84,61 +129,154 @@ namespace DMAtrix {
 
         setup_descriptors(dmadesc, desccount, (uint8_t *)buf, sizeof(T) * size);
       }
-    };
-
-    i2s_dev_t *i2s_dev(size_t num) {
-      assert(num == 0 || num == 1);
 
-      return num ? &I2S1 : &I2S0;
-    }
+      // for each descriptor, whether it starts at a flip point
+      std::vector<bool> flip_points;
 
-    struct ISRInfo {
-      size_t dev;
-      volatile bool flip_done;
-    };
+      /// set up with one descriptor per segment, looping; eof is set on the
+      /// last descriptor, and before every flip point if eof_at_flip_points
+      template <typename Segments>
+      void setup(size_t size, const Segments &segments,
+                 bool eof_at_flip_points) {
+        buf = (T *)heap_caps_malloc(sizeof(T) * size,
+                                    MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA);
+        assert(buf);
+        setup_descriptors(size, segments, eof_at_flip_points);
+      }
 
-    void IRAM_ATTR i2s_isr_ext(void *arg) {
-      ISRInfo *isr_info = (ISRInfo *)arg;
+      /// set up as above, in memory from plan_dma: descs holds the
+      /// descriptors, and data the start of each segment
+      template <typename Segments>
+      void setup(size_t size, const Segments &segments,
+                 bool eof_at_flip_points, lldesc_t *descs,
+                 const std::vector<void *> &data) {
+        // contiguous unless the plan scattered the segments
+        buf = (T *)data[0];
+        for (size_t i = 0; i < segments.size(); i++)
+          if ((T *)data[i] != buf + segments[i].start) buf = nullptr;
+
+        setup_descriptors(size, segments, eof_at_flip_points, descs);
+        seg_data.clear();
+        for (size_t i = 0; i < desccount; i++) {
+          seg_data.push_back((T *)data[i]);
+          dmadesc[i].buf = (uint8_t *)data[i];
+        }
+      }
 
-      i2s_dev_t *dev = isr_info->dev ? &I2S1 : &I2S0;
+      /// set up the descriptors as for setup, pointing into buf, which may
+      /// be null if the descriptors are pointed elsewhere afterwards; they
+      /// are allocated unless descs is given
+      template <typename Segments>
+      void setup_descriptors(size_t size, const Segments &segments,
+                             bool eof_at_flip_points,
+                             lldesc_t *descs = nullptr) {
+        this->size = size;
+        desccount = segments.size();
+        dmadesc = descs ? descs
+                        : (lldesc_t *)heap_caps_malloc(
+                              desccount * sizeof(lldesc_t),
+                              MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA);
+        assert(dmadesc);
 
-      dev->int_clr.out_eof = 1;
+        flip_points.resize(desccount);
+        starts.resize(desccount + 1);
+        for (size_t i = 0; i < desccount; i++) {
+          size_t start = segments[i].start;
+          size_t end = i + 1 < desccount ? segments[i + 1].start : size;
+          size_t len = (end - start) * sizeof(T);
+          assert(len <= DMA_MAX && (start * sizeof(T)) % 4 == 0);
+
+          dmadesc[i].size = (len + 3) & ~3;
+          dmadesc[i].length = len;
+          dmadesc[i].buf = (uint8_t *)(buf + start);
+          dmadesc[i].sosf = 0;
+          dmadesc[i].owner = 1;
+          dmadesc[i].qe.stqe_next = &dmadesc[(i + 1) % desccount];
+          dmadesc[i].offset = 0;
+          flip_points[i] = segments[i].flip_point;
+          starts[i] = start;
+        }
+        starts[desccount] = size;
+
+        for (size_t i = 0; i < desccount; i++)
+          dmadesc[i].eof = i == desccount - 1 ||
+                           (eof_at_flip_points && flip_points[i + 1]);
+      }
+    };
 
-      isr_info->flip_done = true;
+    /// copy_words for DMA buffers, using memcpy. Words are swapped within 32
+    /// bit words (see operator[]), so whole 32 bit words are copied,
+    /// including up to three bytes either side of [begin, end). Scattered
+    /// buffers are copied word by word.
+    template <typename T>
+    void copy_words(DMABuffer<T> &dst, DMABuffer<T> &src, size_t begin,
+                    size_t end) {
+      if (!dst.buf || !src.buf) {
+        for (size_t i = begin; i < end; i++) dst[i] = src[i];
+        return;
+      }
+      constexpr size_t per_word = 4 / sizeof(T);
+      begin = begin & ~(per_word - 1);
+      end = std::min((end + per_word - 1) & ~(per_word - 1), dst.size);
+      memcpy(dst.buf + begin, src.buf + begin, (end - begin) * sizeof(T));
     }
 
-  }
-
-  struct ESP32Config {
-    size_t dev = 0;
-    int clkspeed_hz = 20000000;
-  };
-
-  template <size_t num_pins, size_t num_buffers>
-  struct ESP32I2SDMA {
-    static_assert(num_pins <= 16, "DMA in 32 bit mode is not yet supported");
-    using dtype = typename std::conditional_t<num_pins <= 16, uint16_t, uint32_t>;
-    std::array<esp32::DMABuffer<dtype>, num_buffers> buffers;
+    /// memory for COWBuffers and LoopChain: internal DMA-capable RAM, with
+    /// words in the order used by DMABuffer
+    struct DMAMemory {
+      template <typename T>
+      static T *alloc(size_t len) {
+        return (T *)heap_caps_malloc(sizeof(T) * len,
+                                     MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA);
+      }
+      static void release(void *data) { heap_caps_free(data); }
+      template <typename T>
+      static size_t swizzle(size_t idx) {
+        return sizeof(T) == 1 ? idx ^ 2 : sizeof(T) == 2 ? idx ^ 1 : idx;
+      }
+    };
 
-    using Config = ESP32Config;
+    /// memory for plan_dma: the heap, restricted to internal DMA-capable RAM
+    struct HeapMemory {
+      static constexpr uint32_t caps = MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA;
+      void *alloc(size_t bytes) { return heap_caps_malloc(bytes, caps); }
+      void release(void *data) { heap_caps_free(data); }
+      size_t largest_free() { return heap_caps_get_largest_free_block(caps); }
+    };
 
-    esp32::ISRInfo isr_info;
+    i2s_dev_t *i2s_dev(size_t num) {
+      assert(num == 0 || num == 1);
 
-    void flip_to(size_t buf_idx) {
-      for (auto &buf : buffers)
-        buf.dmadesc[buf.desccount - 1].qe.stqe_next = buffers[buf_idx].dmadesc;
-      isr_info.flip_done = false;
+      return num ? &I2S1 : &I2S0;
     }
 
-    bool flip_done() { return isr_info.flip_done; }
+    inline void i2s_set_clock(i2s_dev_t *dev, int clkspeed_hz) {
+      // We ignore the possibility for fractional division here, clkspeed_hz
+      // must round up for a fractional clock speed, must result in >= 2
+      dev->clkm_conf.clkm_div_a = 63;
+      dev->clkm_conf.clkm_div_b = 63;
+      dev->clkm_conf.clkm_div_num = 80000000L / (clkspeed_hz + 1);
+    }
 
-    void setup(std::array<int, num_pins> data_pins, int clk_pin, Config config,
-               size_t size) {
-      for (auto &buffer : buffers) buffer.setup(size);
+    /// set the clock to 80MHz / (num + b / a); see solve_refresh_rate
+    inline void i2s_set_clock(i2s_dev_t *dev, const ClockDivider &divider) {
+      dev->clkm_conf.clkm_div_a = divider.a;
+      dev->clkm_conf.clkm_div_b = divider.b;
+      dev->clkm_conf.clkm_div_num = divider.num;
+    }
 
-      i2s_dev_t *dev = esp32::i2s_dev(config.dev);
-      constexpr size_t bits = sizeof(dtype) * 8;
+    inline void i2s_set_clock(i2s_dev_t *dev, const ESP32Config &config) {
+      if (config.divider.num)
+        i2s_set_clock(dev, config.divider);
+      else
+        i2s_set_clock(dev, config.clkspeed_hz);
+    }
 
+    /// route pins to dev and configure it for parallel output of bits-wide
+    /// words; DMA is not started
+    inline void i2s_setup(i2s_dev_t *dev, const int *data_pins,
+                          size_t num_pins, int clk_pin,
+                          const ESP32Config &config, size_t bits) {
       // Figure out which signal numbers to use for routing
       int sig_data_base, sig_clk;
       if (dev == &I2S0) {
@@ -150,10 +288,10 @@ namespace DMAtrix {
       }
 
       // Route the signals
-      for (int i = 0; i < num_pins; i++) {
-        esp32::gpio_setup_out(data_pins[i], sig_data_base + i);
+      for (size_t i = 0; i < num_pins; i++) {
+        gpio_setup_out(data_pins[i], sig_data_base + i);
       }
-      esp32::gpio_setup_out(clk_pin, sig_clk);
+      gpio_setup_out(clk_pin, sig_clk);
 
       // Power on dev
       if (dev == &I2S0) {
@@ -166,8 +304,8 @@ namespace DMAtrix {
       dev->conf.rx_reset = 0;
       dev->conf.tx_reset = 1;
       dev->conf.tx_reset = 0;
-      esp32::dma_reset(dev);
-      esp32::fifo_reset(dev);
+      dma_reset(dev);
+      fifo_reset(dev);
 
       // Enable LCD mode
       dev->conf2.val = 0;
@@ -184,11 +322,7 @@ namespace DMAtrix {
 
       dev->clkm_conf.val = 0;
       dev->clkm_conf.clka_en = 0;
-      dev->clkm_conf.clkm_div_a = 63;
-      dev->clkm_conf.clkm_div_b = 63;
-      // We ignore the possibility for fractional division here, clkspeed_hz
-      // must round up for a fractional clock speed, must result in >= 2
-      dev->clkm_conf.clkm_div_num = 80000000L / (config.clkspeed_hz + 1);
+      i2s_set_clock(dev, config);
 
       dev->fifo_conf.val = 0;
       dev->fifo_conf.rx_fifo_mod_force_en = 1;
@@ -230,24 +364,509 @@ namespace DMAtrix {
       dev->conf.tx_reset = 0;
       dev->conf.tx_fifo_reset = 0;
       dev->conf.rx_fifo_reset = 0;
+    }
+
+    /// point the DMA at desc, ready for output to be started with tx_start
+    inline void i2s_link(i2s_dev_t *dev, lldesc_t *desc) {
+      dev->lc_conf.val =
+          I2S_OUT_DATA_BURST_EN | I2S_OUTDSCR_BURST_EN | I2S_OUT_DATA_BURST_EN;
+      dev->out_link.addr = (uint32_t)desc;
+      dev->out_link.start = 1;
+    }
+
+    /// start DMA output from desc
+    inline void i2s_start(i2s_dev_t *dev, lldesc_t *desc) {
+      i2s_link(dev, desc);
+      dev->conf.tx_start = 1;
+    }
+
+    /// stop DMA output straight away, discarding anything in the FIFO
+    inline void i2s_stop(i2s_dev_t *dev) {
+      dev->conf.tx_start = 0;
+      dev->out_link.stop = 1;
+      dma_reset(dev);
+      fifo_reset(dev);
+    }
+
+    template <typename T, size_t num_buffers>
+    struct ISRInfo {
+      size_t dev;
+      DMABuffer<T> *buffers[num_buffers];
+      FlipQueue<num_buffers> flips;
+      bool eof_on_demand;
+
+      // interrupts handled, and CPU cycles spent in them; both wrap
+      volatile uint32_t count = 0;
+      volatile uint32_t cycles = 0;
+    };
+
+    /// At the end of each buffer, find the buffer which the DMA has moved on
+    /// to from its current descriptor, rather than assuming that the last
+    /// flip took effect, as the relink may have come too late.
+    ///
+    /// With eof_on_demand, the interrupt disables itself once no flips are
+    /// pending, and flip_to enables it after queueing a flip.
+    template <typename T, size_t num_buffers>
+    void IRAM_ATTR i2s_isr_ext(void *arg) {
+      uint32_t start = xthal_get_ccount();
+      auto *isr_info = (ISRInfo<T, num_buffers> *)arg;
+
+      i2s_dev_t *dev = isr_info->dev ? &I2S1 : &I2S0;
+
+      dev->int_clr.out_eof = 1;
+
+      lldesc_t *desc = (lldesc_t *)dev->out_link_dscr;
+      for (size_t i = 0; i < num_buffers; i++) {
+        DMABuffer<T> *buf = isr_info->buffers[i];
+        if (desc >= buf->dmadesc && desc < buf->dmadesc + buf->desccount)
+          isr_info->flips.started(i);
+      }
+
+      if (isr_info->eof_on_demand && isr_info->flips.done()) {
+        dev->int_ena.out_eof = 0;
+        // a flip may have been queued (and the interrupt enabled) since the
+        // check above
+        if (!isr_info->flips.done()) dev->int_ena.out_eof = 1;
+      }
+
+      isr_info->count = isr_info->count + 1;
+      isr_info->cycles = isr_info->cycles + (xthal_get_ccount() - start);
+    }
+
+    struct StreamISRInfo {
+      size_t dev;
+      TaskHandle_t task;
+      volatile uint32_t chunks_done;
+    };
+
+    void IRAM_ATTR i2s_stream_isr(void *arg) {
+      StreamISRInfo *isr_info = (StreamISRInfo *)arg;
+
+      i2s_dev_t *dev = isr_info->dev ? &I2S1 : &I2S0;
+
+      dev->int_clr.out_eof = 1;
+
+      isr_info->chunks_done++;
+
+      BaseType_t woken = pdFALSE;
+      vTaskNotifyGiveFromISR(isr_info->task, &woken);
+      if (woken) portYIELD_FROM_ISR();
+    }
+
+  }
+
+  template <size_t num_pins, size_t num_buffers>
+  struct ESP32I2SDMA {
+    static_assert(num_pins <= 16, "DMA in 32 bit mode is not yet supported");
+    using dtype = typename std::conditional_t<num_pins <= 16, uint16_t, uint32_t>;
+    std::array<esp32::DMABuffer<dtype>, num_buffers> buffers;
+
+    using Config = ESP32Config;
+
+    esp32::ISRInfo<dtype, num_buffers> isr_info;
+
+    static constexpr size_t segment_align = 4 / sizeof(dtype);
+
+    static size_t max_segment_len(const Config &config) {
+      size_t max = esp32::DMA_MAX / sizeof(dtype) / segment_align *
+                   segment_align;
+      return config.segment_len ? std::min(config.segment_len, max) : max;
+    }
+
+    /// Flip to buffer buf_idx at the end of the current (or last queued)
+    /// buffer, returning the flip sequence number; see FlipQueue. With
+    /// low_latency, the switch happens at the next flip point instead, by
+    /// linking the end of each segment before a flip point to the same
+    /// position in the new buffer.
+    uint32_t flip_to(size_t buf_idx, bool low_latency = false) {
+      auto link_fn = [&](size_t from, size_t to) {
+        link(from, to, low_latency);
+      };
+      uint32_t seq = isr_info.flips.flip_to(buf_idx, link_fn);
+
+      // the eof status is latched, so if the DMA has already moved on, the
+      // interrupt fires as soon as it is enabled
+      if (isr_info.eof_on_demand)
+        esp32::i2s_dev(isr_info.dev)->int_ena.out_eof = 1;
+      return seq;
+    }
+
+    /// point the end of buffer from (or each segment before a flip point,
+    /// with low_latency) at buffer to; linking a buffer to itself restores
+    /// its chain
+    void link(size_t from, size_t to, bool low_latency) {
+      auto &src = buffers[from];
+      auto &dst = buffers[to];
+      size_t n = src.desccount;
+
+      if (low_latency || from == to) {
+        for (size_t i = 0; i < n; i++)
+          if (i == n - 1 || src.flip_points[i + 1])
+            src.dmadesc[i].qe.stqe_next = &dst.dmadesc[(i + 1) % n];
+      } else
+        src.dmadesc[n - 1].qe.stqe_next = dst.dmadesc;
+    }
+
+    // the ring of descriptors used by play_loop
+    LoopChain<lldesc_t, esp32::DMAMemory> loop;
+
+    /// Play the buffers as a looping animation entirely in hardware: buffer
+    /// i is output for holds[i] refreshes, then the next, wrapping at the
+    /// end, so the CPU is free once this returns. Write every buffer first;
+    /// output restarts from buffer 0. The interrupt is disabled while the
+    /// loop plays, so don't flip until stop_loop. Each repeat costs a copy
+    /// of one buffer's descriptors; see LoopChain.
+    void play_loop(const std::array<size_t, num_buffers> &holds) {
+      i2s_dev_t *dev = esp32::i2s_dev(isr_info.dev);
+      esp32::i2s_stop(dev);
+      dev->int_ena.out_eof = 0;
+
+      lldesc_t *descs[num_buffers];
+      size_t counts[num_buffers];
+      for (size_t i = 0; i < num_buffers; i++) {
+        descs[i] = buffers[i].dmadesc;
+        counts[i] = buffers[i].desccount;
+      }
+      loop.build(descs, counts,
+                 std::vector<size_t>(holds.begin(), holds.end()));
+
+      esp32::i2s_start(dev, buffers[0].dmadesc);
+    }
+
+    /// the buffer being output by play_loop
+    size_t loop_frame() {
+      i2s_dev_t *dev = esp32::i2s_dev(isr_info.dev);
+      return loop.frame_of((lldesc_t *)dev->out_link_dscr);
+    }
+
+    /// stop play_loop, and output buffer buf from its start, with flips
+    /// working as before
+    void stop_loop(size_t buf = 0) {
+      i2s_dev_t *dev = esp32::i2s_dev(isr_info.dev);
+      esp32::i2s_stop(dev);
+      loop.restore();
+      for (size_t i = 0; i < num_buffers; i++) link(i, i, false);
+      isr_info.flips.reset(buf);
+
+      dev->int_clr.out_eof = 1;
+      dev->int_ena.out_eof = !config.eof_on_demand;
+      esp32::i2s_start(dev, buffers[buf].dmadesc);
+    }
+
+    /// number of interrupts handled, and CPU cycles spent in them, since
+    /// setup; both wrap
+    uint32_t isr_count() const { return isr_info.count; }
+    uint32_t isr_cycles() const { return isr_info.cycles; }
+
+    /// true if every flip has completed
+    bool flip_done() { return isr_info.flips.done(); }
+
+    /// true if flip seq has completed
+    bool flip_done(uint32_t seq) { return isr_info.flips.done(seq); }
+
+    /// the start of the descriptor being output, in words; this is only as
+    /// fine as the descriptors, so set segment_len when using it
+    size_t read_position() {
+      i2s_dev_t *dev = esp32::i2s_dev(isr_info.dev);
+      lldesc_t *desc = (lldesc_t *)dev->out_link_dscr;
+      for (auto &buffer : buffers)
+        if (desc >= buffer.dmadesc &&
+            desc < buffer.dmadesc + buffer.desccount)
+          return buffer.starts[desc - buffer.dmadesc];
+      return 0;
+    }
+
+    // where the buffers and descriptors were put; see plan_dma
+    DMAPlan plan;
+
+    /// Set up the buffers and output. All buffers and descriptors are
+    /// allocated together if possible, falling back to scattering segments
+    /// over the free blocks if the heap is fragmented; print plan.report()
+    /// to see which.
+    void setup(std::array<int, num_pins> data_pins, int clk_pin, Config config,
+               size_t size, const std::vector<Segment> &segments) {
+      std::vector<size_t> segment_bytes;
+      for (size_t i = 0; i < segments.size(); i++) {
+        size_t end = i + 1 < segments.size() ? segments[i + 1].start : size;
+        segment_bytes.push_back((end - segments[i].start) * sizeof(dtype));
+      }
+
+      esp32::HeapMemory mem;
+      plan = plan_dma(mem, num_buffers, segment_bytes,
+                      num_buffers * segments.size() * sizeof(lldesc_t));
+      if (!plan.ok()) printf("%s", plan.report().c_str());
+      assert(plan.ok());
+
+      for (size_t i = 0; i < num_buffers; i++)
+        buffers[i].setup(size, segments, config.low_latency_flips,
+                         (lldesc_t *)plan.descriptors + i * segments.size(),
+                         plan.segments[i]);
+      setup_output(data_pins, clk_pin, config);
+    }
+
+    /// set up the I2S device and interrupt, once the buffers are set up
+    void setup_output(std::array<int, num_pins> data_pins, int clk_pin,
+                      Config config) {
+      blank_buffer.setup(blank_len, std::vector<Segment>{{0, false}}, false);
+      blank_buffer.dmadesc[0].eof = 0;
+      this->config = config;
+
+      i2s_dev_t *dev = esp32::i2s_dev(config.dev);
+      esp32::i2s_setup(dev, data_pins.data(), num_pins, clk_pin, config,
+                       sizeof(dtype) * 8);
 
       isr_info.dev = config.dev;
-      isr_info.flip_done = false;
+      isr_info.eof_on_demand = config.eof_on_demand;
+      for (size_t i = 0; i < num_buffers; i++)
+        isr_info.buffers[i] = &buffers[i];
 
       // setup I2S Interrupt
-      dev->int_ena.out_eof = 1;
+      dev->int_ena.out_eof = !config.eof_on_demand;
 
       // allocate a level 1 intterupt: lowest priority, as ISR isn't urgent
       int int_no = dev == &I2S1 ? ETS_I2S1_INTR_SOURCE : ETS_I2S0_INTR_SOURCE;
       esp_intr_alloc(int_no, (int)(ESP_INTR_FLAG_IRAM | ESP_INTR_FLAG_LEVEL1),
-                     esp32::i2s_isr_ext, (void *)&isr_info, NULL);
+                     esp32::i2s_isr_ext<dtype, num_buffers>, (void *)&isr_info,
+                     NULL);
 
-      // Start dma on front buffer
-      dev->lc_conf.val =
-          I2S_OUT_DATA_BURST_EN | I2S_OUTDSCR_BURST_EN | I2S_OUT_DATA_BURST_EN;
-      dev->out_link.addr = (uint32_t)buffers[0].dmadesc;
-      dev->out_link.start = 1;
-      dev->conf.tx_start = 1;
+      if (config.autostart) start();
+    }
+
+    /// set up without flip points, for buffers not made by a BufferModel
+    void setup(std::array<int, num_pins> data_pins, int clk_pin, Config config,
+               size_t size) {
+      std::vector<Segment> segments;
+      for (size_t start = 0; start < size; start += max_segment_len(config))
+        segments.push_back({start, false});
+      setup(data_pins, clk_pin, config, size, segments);
+    }
+
+    /// start DMA on the front buffer
+    void start() {
+      esp32::i2s_start(esp32::i2s_dev(isr_info.dev), buffers[0].dmadesc);
+    }
+
+    // a few words looping on one descriptor, without eof, output while
+    // blanked
+    esp32::DMABuffer<dtype> blank_buffer;
+    static constexpr size_t blank_len = 8;
+    Config config;
+
+    /// Switch the output to a loop of blank_len copies of word, at
+    /// clkspeed_hz if given, leaving the buffers untouched. Flips made while
+    /// blanked take effect after unblank.
+    void blank(dtype word, int clkspeed_hz = 0) {
+      i2s_dev_t *dev = esp32::i2s_dev(isr_info.dev);
+      esp32::i2s_stop(dev);
+      for (size_t i = 0; i < blank_len; i++) blank_buffer[i] = word;
+      if (clkspeed_hz) esp32::i2s_set_clock(dev, clkspeed_hz);
+      esp32::i2s_start(dev, blank_buffer.dmadesc);
+    }
+
+    /// resume output from the start of the front buffer
+    void unblank() {
+      i2s_dev_t *dev = esp32::i2s_dev(isr_info.dev);
+      esp32::i2s_stop(dev);
+      esp32::i2s_set_clock(dev, config);
+      esp32::i2s_start(dev, buffers[isr_info.flips.front].dmadesc);
+    }
+  };
+
+  /// ESP32I2SDMA with copy-on-write buffers (see COWBuffers): each segment is
+  /// stored once until it is written through one buffer, and the descriptors
+  /// of each buffer are pointed at its copy. Use with FlipMode::CopyForward,
+  /// so that the copies are dropped once each flip completes; the memory used
+  /// on top of one buffer is then proportional to the segments changed per
+  /// frame. Set segment_len to trade descriptor count for copy granularity.
+  template <size_t num_pins, size_t num_buffers>
+  struct ESP32I2SCOWDMA : ESP32I2SDMA<num_pins, num_buffers> {
+    static_assert(num_buffers == 2, "copy-on-write needs two buffers");
+    using Base = ESP32I2SDMA<num_pins, num_buffers>;
+    using typename Base::Config;
+    using typename Base::dtype;
+
+    COWBuffers<dtype, esp32::DMAMemory> storage;
+    // hides Base::buffers, which only hold the descriptors
+    std::array<COWView<dtype, esp32::DMAMemory>, 2> buffers{
+        {{&storage, 0}, {&storage, 1}}};
+
+    static void moved(void *arg, size_t buf, size_t segment, dtype *data) {
+      auto *self = (ESP32I2SCOWDMA *)arg;
+      self->Base::buffers[buf].dmadesc[segment].buf = (uint8_t *)data;
+    }
+
+    void setup(std::array<int, num_pins> data_pins, int clk_pin, Config config,
+               size_t size, const std::vector<Segment> &segments) {
+      storage.setup(size, segments);
+      storage.moved = moved;
+      storage.moved_arg = (void *)this;
+
+      for (size_t buf = 0; buf < 2; buf++) {
+        Base::buffers[buf].setup_descriptors(size, segments,
+                                             config.low_latency_flips);
+        for (size_t seg = 0; seg < segments.size(); seg++)
+          moved(this, buf, seg, storage.data[buf][seg]);
+      }
+      Base::setup_output(data_pins, clk_pin, config);
+    }
+
+    /// the start of the segment being output, in words
+    size_t read_position() {
+      i2s_dev_t *dev = esp32::i2s_dev(this->isr_info.dev);
+      lldesc_t *desc = (lldesc_t *)dev->out_link_dscr;
+      for (auto &buffer : Base::buffers)
+        if (desc >= buffer.dmadesc &&
+            desc < buffer.dmadesc + buffer.desccount)
+          return storage.starts[desc - buffer.dmadesc];
+      return 0;
+    }
+  };
+
+  /// start two drivers (on different I2S devices) on the same clock cycle, as
+  /// near as possible
+  template <size_t num_pins, size_t num_buffers>
+  void start_together(ESP32I2SDMA<num_pins, num_buffers> &a,
+                      ESP32I2SDMA<num_pins, num_buffers> &b) {
+    i2s_dev_t *dev_a = esp32::i2s_dev(a.isr_info.dev);
+    i2s_dev_t *dev_b = esp32::i2s_dev(b.isr_info.dev);
+    esp32::i2s_link(dev_a, a.buffers[0].dmadesc);
+    esp32::i2s_link(dev_b, b.buffers[0].dmadesc);
+
+    portDISABLE_INTERRUPTS();
+    dev_a->conf.tx_start = 1;
+    dev_b->conf.tx_start = 1;
+    portENABLE_INTERRUPTS();
+  }
+
+  /// unblank two drivers which were started together, on the same clock
+  /// cycle as near as possible
+  template <size_t num_pins, size_t num_buffers>
+  void unblank_together(ESP32I2SDMA<num_pins, num_buffers> &a,
+                        ESP32I2SDMA<num_pins, num_buffers> &b) {
+    i2s_dev_t *dev_a = esp32::i2s_dev(a.isr_info.dev);
+    i2s_dev_t *dev_b = esp32::i2s_dev(b.isr_info.dev);
+    esp32::i2s_stop(dev_a);
+    esp32::i2s_stop(dev_b);
+    esp32::i2s_set_clock(dev_a, a.config);
+    esp32::i2s_set_clock(dev_b, b.config);
+    esp32::i2s_link(dev_a, a.buffers[a.isr_info.flips.front].dmadesc);
+    esp32::i2s_link(dev_b, b.buffers[b.isr_info.flips.front].dmadesc);
+
+    portDISABLE_INTERRUPTS();
+    dev_a->conf.tx_start = 1;
+    dev_b->conf.tx_start = 1;
+    portENABLE_INTERRUPTS();
+  }
+
+  /// flip two drivers which were started together, with interrupts disabled
+  /// so that both are relinked within a few cycles of each other
+  template <size_t num_pins, size_t num_buffers>
+  void flip_together(ESP32I2SDMA<num_pins, num_buffers> &a, size_t a_buf,
+                     ESP32I2SDMA<num_pins, num_buffers> &b, size_t b_buf) {
+    portDISABLE_INTERRUPTS();
+    a.flip_to(a_buf);
+    b.flip_to(b_buf);
+    portENABLE_INTERRUPTS();
+  }
+
+  struct ESP32StreamConfig : ESP32Config {
+    // length in words of each bounce buffer, and the number of them; each
+    // chunk must fit in one DMA descriptor
+    size_t chunk_len = 1024;
+    size_t num_chunks = 4;
+
+    // the refill task should run above anything which could hold it off for
+    // longer than (num_chunks - 1) chunks
+    UBaseType_t task_priority = configMAX_PRIORITIES - 1;
+    BaseType_t task_core = 1;
+  };
+
+  /// Streaming DMA driver: outputs a ring of small bounce buffers, calling fill
+  /// from a high priority task to regenerate each chunk once it has been sent.
+  template <size_t num_pins>
+  struct ESP32I2SStream {
+    static_assert(num_pins <= 16, "DMA in 32 bit mode is not yet supported");
+    using dtype = typename std::conditional_t<num_pins <= 16, uint16_t, uint32_t>;
+    using Chunk = esp32::DMABuffer<dtype>;
+    using FillFn = void (*)(void *arg, Chunk &chunk, size_t len);
+
+    using Config = ESP32StreamConfig;
+
+    std::vector<Chunk> chunks;
+    size_t chunk_len;
+    FillFn fill;
+    void *fill_arg;
+
+    // number of chunks which have been filled, and the number of times the
+    // DMA overtook the fill task
+    uint32_t chunks_filled = 0;
+    uint32_t underruns = 0;
+
+    esp32::StreamISRInfo isr_info;
+
+    void fill_next() {
+      fill(fill_arg, chunks[chunks_filled % chunks.size()], chunk_len);
+      chunks_filled++;
+    }
+
+    static void fill_task(void *arg) {
+      ESP32I2SStream *self = (ESP32I2SStream *)arg;
+
+      while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        uint32_t done = self->isr_info.chunks_done;
+        if (done >= self->chunks_filled) {
+          // the DMA is playing stale data; skip ahead to keep the remaining
+          // chunks in order
+          self->underruns++;
+          self->chunks_filled = done + 1;
+        }
+
+        while (self->chunks_filled < done + self->chunks.size())
+          self->fill_next();
+      }
+    }
+
+    void setup(std::array<int, num_pins> data_pins, int clk_pin, Config config,
+               FillFn fill, void *fill_arg) {
+      assert(config.chunk_len * sizeof(dtype) <= esp32::DMA_MAX);
+      assert(config.chunk_len * sizeof(dtype) % 4 == 0);
+      assert(config.num_chunks >= 2);
+
+      this->fill = fill;
+      this->fill_arg = fill_arg;
+      chunk_len = config.chunk_len;
+
+      // link the chunks into a ring, with an EOF interrupt after each
+      chunks.resize(config.num_chunks);
+      for (auto &chunk : chunks) chunk.setup(chunk_len);
+      for (size_t i = 0; i < chunks.size(); i++) {
+        chunks[i].dmadesc[0].eof = 1;
+        chunks[i].dmadesc[0].qe.stqe_next =
+            chunks[(i + 1) % chunks.size()].dmadesc;
+      }
+
+      for (size_t i = 0; i < chunks.size(); i++) fill_next();
+
+      i2s_dev_t *dev = esp32::i2s_dev(config.dev);
+      esp32::i2s_setup(dev, data_pins.data(), num_pins, clk_pin, config,
+                       sizeof(dtype) * 8);
+
+      isr_info.dev = config.dev;
+      isr_info.chunks_done = 0;
+      xTaskCreatePinnedToCore(fill_task, "dmatrix_fill", 4096, (void *)this,
+                              config.task_priority, &isr_info.task,
+                              config.task_core);
+
+      dev->int_ena.out_eof = 1;
+
+      // refilling is urgent, so use a higher priority than ESP32I2SDMA
+      int int_no = dev == &I2S1 ? ETS_I2S1_INTR_SOURCE : ETS_I2S0_INTR_SOURCE;
+      esp_intr_alloc(int_no, (int)(ESP_INTR_FLAG_IRAM | ESP_INTR_FLAG_LEVEL3),
+                     esp32::i2s_stream_isr, (void *)&isr_info, NULL);
+
+      esp32::i2s_start(dev, chunks[0].dmadesc);
     }
   };
 
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <esp_partition.h>
+#include <cstdint>
+
+namespace DMAtrix {
+
+  /// A data partition in flash mapped into the address space, for use as a
+  /// playback source mapping on the ESP32. Reads go through the flash cache,
+  /// so there is nothing to do to read ahead.
+  struct ESP32MappedPartition {
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    spi_flash_mmap_handle_t handle;
+
+    ESP32MappedPartition() {}
+    ESP32MappedPartition(const ESP32MappedPartition &) = delete;
+    ESP32MappedPartition &operator=(const ESP32MappedPartition &) = delete;
+
+    /// map the data partition with the given label, returning false on error
+    bool open(const char *label) {
+      close();
+      const esp_partition_t *partition = esp_partition_find_first(
+          ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+      if (!partition) return false;
+
+      const void *p;
+      if (esp_partition_mmap(partition, 0, partition->size,
+                             SPI_FLASH_MMAP_DATA, &p, &handle) != ESP_OK)
+        return false;
+
+      data = (const uint8_t *)p;
+      size = partition->size;
+      return true;
+    }
+
+    void read_ahead(size_t offset, size_t len) {}
+
+    void close() {
+      if (data) spi_flash_munmap(handle);
+      data = nullptr;
+      size = 0;
+    }
+
+    ~ESP32MappedPartition() { close(); }
+  };
+
+}
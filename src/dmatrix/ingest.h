@@ -0,0 +1,321 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+namespace DMAtrix {
+
+  /// A packet received from the network, with data pointing into the
+  /// received datagram.
+  struct Packet {
+    enum class Type {
+      /// not a packet we understand
+      Invalid,
+      /// pixel data for one universe
+      Data,
+      /// present the data received since the last sync
+      Sync,
+    };
+
+    Type type = Type::Invalid;
+    uint16_t universe = 0;
+    const uint8_t *data = nullptr;
+    size_t len = 0;
+    /// for E1.31 data, the universe whose sync packets present this data, or
+    /// 0 if it should be presented immediately
+    uint16_t sync_universe = 0;
+  };
+
+  namespace detail {
+    inline uint16_t read_be16(const uint8_t *p) { return (p[0] << 8) | p[1]; }
+    inline uint16_t read_le16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+    inline uint32_t read_be32(const uint8_t *p) {
+      return ((uint32_t)read_be16(p) << 16) | read_be16(p + 2);
+    }
+
+    inline void write_be16(uint8_t *p, uint16_t x) {
+      p[0] = x >> 8;
+      p[1] = x;
+    }
+    inline void write_le16(uint8_t *p, uint16_t x) {
+      p[0] = x;
+      p[1] = x >> 8;
+    }
+    inline void write_be32(uint8_t *p, uint32_t x) {
+      write_be16(p, x >> 16);
+      write_be16(p + 2, x);
+    }
+
+    inline void write_e131_root(uint8_t *buf, size_t len, uint32_t vector) {
+      memset(buf, 0, len);
+      write_be16(buf, 0x0010);
+      memcpy(buf + 4, "ASC-E1.17\0\0\0", 12);
+      write_be16(buf + 16, 0x7000 | (len - 16));
+      write_be32(buf + 18, vector);
+      write_be16(buf + 38, 0x7000 | (len - 38));
+    }
+  }  // namespace detail
+
+  // Packet builders, for senders and tests. Each writes a packet into buf
+  // (which must be large enough) and returns its length.
+
+  /// ArtDmx with len (at most 512) bytes of data
+  inline size_t make_artnet_dmx(uint8_t *buf, uint16_t universe,
+                                const uint8_t *data, size_t len,
+                                uint8_t sequence = 0) {
+    using namespace detail;
+    memcpy(buf, "Art-Net\0", 8);
+    write_le16(buf + 8, 0x5000);
+    write_be16(buf + 10, 14);
+    buf[12] = sequence;
+    buf[13] = 0;
+    write_le16(buf + 14, universe);
+    write_be16(buf + 16, len);
+    memcpy(buf + 18, data, len);
+    return 18 + len;
+  }
+
+  inline size_t make_artnet_sync(uint8_t *buf) {
+    using namespace detail;
+    memcpy(buf, "Art-Net\0", 8);
+    write_le16(buf + 8, 0x5200);
+    write_be16(buf + 10, 14);
+    buf[12] = buf[13] = 0;
+    return 14;
+  }
+
+  /// E1.31 data packet with len (at most 512) bytes of data
+  inline size_t make_e131_data(uint8_t *buf, uint16_t universe,
+                               const uint8_t *data, size_t len,
+                               uint16_t sync_universe = 0,
+                               uint8_t sequence = 0) {
+    using namespace detail;
+    size_t total = 126 + len;
+    write_e131_root(buf, total, 0x4);
+    write_be32(buf + 40, 0x2);
+    buf[108] = 100;  // priority
+    write_be16(buf + 109, sync_universe);
+    buf[111] = sequence;
+    write_be16(buf + 113, universe);
+    write_be16(buf + 115, 0x7000 | (total - 115));
+    buf[117] = 0x02;
+    buf[118] = 0xa1;
+    write_be16(buf + 121, 1);
+    write_be16(buf + 123, len + 1);
+    memcpy(buf + 126, data, len);
+    return total;
+  }
+
+  inline size_t make_e131_sync(uint8_t *buf, uint16_t sync_universe,
+                               uint8_t sequence = 0) {
+    using namespace detail;
+    write_e131_root(buf, 49, 0x8);
+    write_be32(buf + 40, 0x1);
+    buf[44] = sequence;
+    write_be16(buf + 45, sync_universe);
+    return 49;
+  }
+
+  /// parse an Art-Net ArtDmx or ArtSync packet
+  inline Packet parse_artnet(const uint8_t *buf, size_t len) {
+    using namespace detail;
+    Packet packet;
+    if (len < 14 || memcmp(buf, "Art-Net\0", 8) != 0) return packet;
+
+    switch (read_le16(buf + 8)) {
+      case 0x5000:  // ArtDmx
+        if (len < 18) break;
+        packet.universe = read_le16(buf + 14) & 0x7fff;
+        packet.data = buf + 18;
+        packet.len = std::min<size_t>(read_be16(buf + 16), len - 18);
+        packet.type = Packet::Type::Data;
+        break;
+      case 0x5200:  // ArtSync
+        packet.type = Packet::Type::Sync;
+        break;
+    }
+    return packet;
+  }
+
+  /// parse an E1.31 (sACN) data or universe synchronization packet; only
+  /// data packets with the null start code are accepted
+  inline Packet parse_e131(const uint8_t *buf, size_t len) {
+    using namespace detail;
+    Packet packet;
+    if (len < 49 || memcmp(buf + 4, "ASC-E1.17\0\0\0", 12) != 0)
+      return packet;
+
+    uint32_t root_vector = read_be32(buf + 18);
+    uint32_t framing_vector = read_be32(buf + 40);
+
+    if (root_vector == 0x4 && framing_vector == 0x2) {
+      if (len < 126 || buf[117] != 0x02 || buf[125] != 0) return packet;
+      size_t count = read_be16(buf + 123);  // includes the start code
+      if (count == 0) return packet;
+
+      packet.universe = read_be16(buf + 113);
+      packet.sync_universe = read_be16(buf + 109);
+      packet.data = buf + 126;
+      packet.len = std::min<size_t>(count - 1, len - 126);
+      packet.type = Packet::Type::Data;
+    } else if (root_vector == 0x8 && framing_vector == 0x1) {
+      packet.universe = read_be16(buf + 45);
+      packet.type = Packet::Type::Sync;
+    }
+    return packet;
+  }
+
+  /// parse either type of packet
+  inline Packet parse_packet(const uint8_t *buf, size_t len) {
+    Packet packet = parse_artnet(buf, len);
+    if (packet.type == Packet::Type::Invalid) packet = parse_e131(buf, len);
+    return packet;
+  }
+
+  /// Receives universes of 8 bit RGB pixel data, and decodes each straight
+  /// into the back buffer of a display driver with Driver::blit, flipping on
+  /// each sync packet which follows data for the display. E1.31 sync packets
+  /// only present data which names their sync universe; ArtSync presents
+  /// everything.
+  ///
+  /// Pixels are mapped in row-major order, with pixels_per_universe in each
+  /// universe starting at first_universe; pixels never span universes. Until
+  /// the first sync packet is seen (or E1.31 data names a sync universe), the
+  /// display is flipped after the last universe instead, as Art-Net receivers
+  /// do.
+  ///
+  /// Datagrams are read from a Source, which must have a method
+  /// size_t receive(uint8_t *buf, size_t len), returning the length of the
+  /// next datagram, or 0 if there are none waiting. While a flip is
+  /// completing, poll leaves datagrams in the source rather than waiting.
+  template <typename D, typename Driver>
+  struct Ingest {
+    Driver &driver;
+    uint16_t first_universe;
+    size_t pixels_per_universe;
+
+    bool synced = false;
+    // data has been written since the last flip
+    bool dirty = false;
+    // the E1.31 sync universe named by that data, or 0 for none
+    uint16_t sync_universe = 0;
+    // a flip has been requested but has not completed yet
+    bool flipping = false;
+
+    struct Stats {
+      size_t packets = 0;
+      size_t invalid = 0;
+      size_t ignored = 0;  // universes not on the display
+      size_t frames = 0;
+      size_t flip_waits = 0;  // polls stopped by a flip not yet completed
+    } stats;
+
+    static constexpr size_t num_pixels = D::rows * D::cols;
+
+    Ingest(Driver &driver, uint16_t first_universe = 1,
+           size_t pixels_per_universe = 170)
+        : driver(driver),
+          first_universe(first_universe),
+          pixels_per_universe(pixels_per_universe) {}
+
+    size_t num_universes() const {
+      return (num_pixels + pixels_per_universe - 1) / pixels_per_universe;
+    }
+
+    /// whether the last flip has yet to complete; until it has, the back
+    /// buffer is still being shown, so no data can be handled
+    bool flip_pending() {
+      if (flipping && driver.flip_done()) flipping = false;
+      return flipping;
+    }
+
+    /// handle one datagram; must not be called while flip_pending()
+    void handle(const uint8_t *buf, size_t len) {
+      stats.packets++;
+      Packet packet = parse_packet(buf, len);
+
+      switch (packet.type) {
+        case Packet::Type::Invalid:
+          stats.invalid++;
+          break;
+        case Packet::Type::Data:
+          if (packet.sync_universe) synced = true;
+          if (!decode(packet)) {
+            stats.ignored++;
+            break;
+          }
+          sync_universe = packet.sync_universe;
+          if (!synced &&
+              packet.universe == first_universe + num_universes() - 1)
+            flip();
+          break;
+        case Packet::Type::Sync:
+          synced = true;
+          if (!packet.universe || packet.universe == sync_universe) flip();
+          break;
+      }
+    }
+
+    /// handle every datagram waiting in source, or those before a flip
+    /// which has not completed yet, returning the number handled
+    template <typename Source>
+    size_t poll(Source &source) {
+      uint8_t buf[1500];
+      size_t count = 0;
+      while (true) {
+        if (flip_pending()) {
+          stats.flip_waits++;
+          break;
+        }
+        size_t len = source.receive(buf, sizeof(buf));
+        if (!len) break;
+        handle(buf, len);
+        count++;
+      }
+      return count;
+    }
+
+    /// write the pixels in packet to the back buffer, returning false if the
+    /// universe isn't on the display
+    bool decode(const Packet &packet) {
+      if (packet.universe < first_universe ||
+          packet.universe >= first_universe + num_universes())
+        return false;
+
+      // see handle; flip_pending is called outside the assert, as it
+      // updates flipping
+      bool pending = flip_pending();
+      assert(!pending);
+      (void)pending;
+
+      size_t pixel = (packet.universe - first_universe) * pixels_per_universe;
+      size_t end = std::min(
+          {pixel + pixels_per_universe, pixel + packet.len / D::colors,
+           num_pixels});
+      const uint8_t *rgb = packet.data;
+
+      // split into runs along each row
+      while (pixel < end) {
+        size_t row = pixel / D::cols, col = pixel % D::cols;
+        size_t len = std::min(end - pixel, D::cols - col);
+        driver.blit(row, col, 1, len, rgb);
+        pixel += len;
+        rgb += len * D::colors;
+      }
+
+      dirty = true;
+      return true;
+    }
+
+    void flip() {
+      if (!dirty) return;
+      driver.flip();
+      dirty = false;
+      flipping = true;
+      stats.frames++;
+    }
+  };
+
+}
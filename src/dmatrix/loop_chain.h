@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <vector>
+#include "cow_buffer.h"
+
+namespace DMAtrix {
+
+  /// Links the descriptor chains of several frames into a ring which the DMA
+  /// plays with no CPU involvement: frame i is output holds[i] times, then
+  /// frame i + 1, wrapping at the end. Each repeat after the first is a copy
+  /// of the frame's descriptors pointing at the same data, so the cost is
+  /// one descriptor per segment per extra repeat, and no buffer memory.
+  ///
+  /// Desc is a DMA descriptor like lldesc_t, with eof and qe.stqe_next; Mem
+  /// allocates the copies (see HostMemory). eof is cleared on every
+  /// descriptor in the ring, so no interrupts fire while it plays.
+  template <typename Desc, typename Mem = HostMemory>
+  struct LoopChain {
+    struct Frame {
+      Desc *descs;
+      size_t count;
+      // the original descriptors, to restore the links and eof flags
+      std::vector<Desc> saved;
+      // holds - 1 copies of descs, one after another
+      Desc *repeats = nullptr;
+      size_t num_repeats = 0;
+    };
+    std::vector<Frame> frames;
+
+    LoopChain() = default;
+    LoopChain(const LoopChain &) = delete;
+    ~LoopChain() { restore(); }
+
+    bool active() const { return !frames.empty(); }
+
+    /// Link the chains descs[i] of counts[i] descriptors into a ring, each
+    /// shown holds[i] times. The chains must not be being output, except
+    /// that the DMA may already be in the first one.
+    void build(Desc *const *descs, const size_t *counts,
+               const std::vector<size_t> &holds) {
+      restore();
+      for (size_t i = 0; i < holds.size(); i++) {
+        assert(holds[i] >= 1);
+        Frame frame{descs[i], counts[i], {descs[i], descs[i] + counts[i]}};
+        frame.num_repeats = holds[i] - 1;
+        if (frame.num_repeats) {
+          frame.repeats =
+              Mem::template alloc<Desc>(frame.num_repeats * frame.count);
+          assert(frame.repeats);
+        }
+        frames.push_back(std::move(frame));
+      }
+
+      // fill in each frame from the end, so the first descriptor of the
+      // next frame is linked before anything points at it
+      for (size_t i = frames.size(); i-- > 0;) {
+        Frame &frame = frames[i];
+        Desc *next = frames[(i + 1) % frames.size()].descs;
+
+        for (size_t r = frame.num_repeats; r-- > 0;) {
+          Desc *copy = frame.repeats + r * frame.count;
+          chain(copy, frame.descs, frame.count, next);
+          next = copy;
+        }
+        chain(frame.descs, frame.descs, frame.count, next);
+      }
+    }
+
+    /// Put the original descriptors back and free the copies. The DMA must
+    /// not be reading the copies; stop it first.
+    void restore() {
+      for (Frame &frame : frames) {
+        for (size_t i = 0; i < frame.count; i++) {
+          frame.descs[i].eof = frame.saved[i].eof;
+          frame.descs[i].qe.stqe_next = frame.saved[i].qe.stqe_next;
+        }
+        if (frame.repeats) Mem::release(frame.repeats);
+      }
+      frames.clear();
+    }
+
+    /// the frame which desc belongs to, whether it is one of the original
+    /// descriptors or a copy, or frames.size() if none
+    size_t frame_of(const Desc *desc) const {
+      for (size_t i = 0; i < frames.size(); i++) {
+        const Frame &frame = frames[i];
+        if ((desc >= frame.descs && desc < frame.descs + frame.count) ||
+            (desc >= frame.repeats &&
+             desc < frame.repeats + frame.num_repeats * frame.count))
+          return i;
+      }
+      return frames.size();
+    }
+
+   private:
+    // make dst a copy of the count descriptors at src, linked in order,
+    // without eof, with the last linked to next
+    static void chain(Desc *dst, const Desc *src, size_t count, Desc *next) {
+      for (size_t i = count; i-- > 0;) {
+        if (dst != src) dst[i] = src[i];
+        dst[i].eof = 0;
+        dst[i].qe.stqe_next = i + 1 < count ? &dst[i + 1] : next;
+      }
+    }
+  };
+
+}
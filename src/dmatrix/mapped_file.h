@@ -0,0 +1,63 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+
+namespace DMAtrix {
+
+  /// A read-only memory-mapped file, for use as a playback source mapping on
+  /// POSIX hosts. The kernel is asked to read ahead sequentially, and
+  /// read_ahead requests specific ranges before they are needed.
+  struct MappedFile {
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+
+    MappedFile() {}
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    /// map path, returning false on error
+    bool open(const char *path) {
+      close();
+      int fd = ::open(path, O_RDONLY);
+      if (fd < 0) return false;
+
+      struct stat st;
+      if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        ::close(fd);
+        return false;
+      }
+
+      void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      ::close(fd);
+      if (p == MAP_FAILED) return false;
+
+      data = (const uint8_t *)p;
+      size = st.st_size;
+      madvise(p, size, MADV_SEQUENTIAL);
+      return true;
+    }
+
+    /// start reading [offset, offset + len) into memory
+    void read_ahead(size_t offset, size_t len) {
+      size_t page = sysconf(_SC_PAGESIZE);
+      size_t begin = offset & ~(page - 1);
+      size_t end = std::min(offset + len, size);
+      if (begin < end)
+        madvise((void *)(data + begin), end - begin, MADV_WILLNEED);
+    }
+
+    void close() {
+      if (data) munmap((void *)data, size);
+      data = nullptr;
+      size = 0;
+    }
+
+    ~MappedFile() { close(); }
+  };
+
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include "animation.h"
+
+namespace DMAtrix {
+
+  // Playback sources write frames from a mapping into the back buffer of a
+  // (non-framebuffered) DisplayDriver, reading directly from the mapping
+  // with no intermediate copies, and asking it to read the next frame ahead
+  // while the current one is displayed.
+  //
+  // A mapping has data and size members, and a method
+  // read_ahead(offset, len); see MappedFile (mapped_file.h) for POSIX hosts,
+  // ESP32MappedPartition (hw/esp32_partition.h) for flash on the ESP32, or
+  // MemoryMapping for data already in memory.
+  //
+  // Sources check the mapping on construction: if it can't be played, ok is
+  // false and nothing is written.
+
+  /// mapping for data which is already in memory
+  struct MemoryMapping {
+    const uint8_t *data;
+    size_t size;
+
+    void read_ahead(size_t offset, size_t len) {}
+  };
+
+  /// frames from an animation made by AnimationCompiler, which must be
+  /// playable on driver (see Animation::playable)
+  template <typename D, typename Mapping>
+  struct AnimationSource {
+    Mapping &mapping;
+    Animation<D> animation;
+    size_t frame = 0;
+    bool ok;
+
+    template <typename Driver>
+    AnimationSource(Mapping &mapping, const Driver &driver)
+        : mapping(mapping),
+          animation(mapping.data, mapping.size),
+          ok(animation.playable(driver)) {}
+
+    size_t num_frames() const { return ok ? animation.num_frames() : 0; }
+
+    /// write the next frame into the back buffer of driver, returning false
+    /// if the animation was rejected
+    template <typename Driver>
+    bool next(Driver &driver) {
+      if (!ok) return false;
+      animation.apply(driver.pin_driver.buffers[driver.back_buffer], frame);
+      frame = (frame + 1) % num_frames();
+      mapping.read_ahead(animation.frame_offset(frame),
+                         animation.frame_size(frame));
+      return true;
+    }
+  };
+
+  /// raw frames of interleaved 8 bit (r, g, b) values in row-major order,
+  /// which are encoded on playback; a mapping shorter than one frame is
+  /// rejected
+  template <typename D, typename Mapping>
+  struct RawSource {
+    static constexpr size_t frame_bytes = D::rows * D::cols * D::colors;
+
+    Mapping &mapping;
+    size_t frame = 0;
+    bool ok;
+
+    RawSource(Mapping &mapping)
+        : mapping(mapping), ok(mapping.size >= frame_bytes) {}
+
+    size_t num_frames() const { return mapping.size / frame_bytes; }
+
+    template <typename Driver>
+    bool next(Driver &driver) {
+      if (!ok) return false;
+      driver.write_image(mapping.data + frame * frame_bytes);
+      frame = (frame + 1) % num_frames();
+      mapping.read_ahead(frame * frame_bytes, frame_bytes);
+      return true;
+    }
+  };
+
+  /// wait for the last flip, then show the next frame from source,
+  /// returning false if the source was rejected
+  template <typename Driver, typename Source>
+  bool play_frame(Driver &driver, Source &source) {
+    if (!source.ok) return false;
+    while (!driver.flip_done()) {
+    }
+    source.next(driver);
+    driver.flip();
+    return true;
+  }
+
+}
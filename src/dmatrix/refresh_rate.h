@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+namespace DMAtrix {
+
+  /// A fractional clock divider, dividing by num + b / a.
+  struct ClockDivider {
+    uint32_t num = 0;
+    uint32_t b = 0;
+    uint32_t a = 1;
+
+    double divisor() const { return num + (double)b / a; }
+  };
+
+  /// The range of dividers supported by a platform, and the maximum output
+  /// clock rate. The defaults are for the ESP32 I2S peripheral.
+  struct ClockLimits {
+    double source_hz = 80000000;
+    double max_hz = 20000000;
+    uint32_t min_num = 2;
+    uint32_t max_num = 255;
+    uint32_t max_a = 63;
+  };
+
+  /// the closest divider to divisor within limits
+  inline ClockDivider closest_divider(double divisor,
+                                      const ClockLimits &limits = {}) {
+    ClockDivider best;
+    double best_error = INFINITY;
+
+    for (uint32_t a = 1; a <= limits.max_a; a++) {
+      double scaled = std::round(divisor * a);
+      if (scaled < (double)limits.min_num * a)
+        scaled = (double)limits.min_num * a;
+      if (scaled > (double)limits.max_num * a)
+        scaled = (double)limits.max_num * a;
+
+      ClockDivider div;
+      div.num = (uint32_t)scaled / a;
+      div.b = (uint32_t)scaled % a;
+      div.a = a;
+
+      double error = std::abs(div.divisor() - divisor);
+      if (error < best_error) {
+        best = div;
+        best_error = error;
+      }
+    }
+    return best;
+  }
+
+  /// A clock divider and buffer length which give a refresh rate.
+  struct RefreshTiming {
+    ClockDivider divider;
+    size_t buf_len;
+    double clock_hz;
+    double refresh_hz;
+    /// (refresh_hz - target) / target
+    double error;
+  };
+
+  /// Find the divider and buffer length (at least min_len, the length of the
+  /// unpadded buffer) which give the refresh rate closest to target_hz,
+  /// preferring shorter buffers. The buffer can then be padded to buf_len;
+  /// see the BufferModel constructor.
+  inline RefreshTiming solve_refresh_rate(double target_hz, size_t min_len,
+                                          const ClockLimits &limits = {}) {
+    RefreshTiming best;
+    best.error = INFINITY;
+
+    // the clock rate can't exceed max_hz, so neither can target * buf_len
+    size_t max_len = (size_t)(limits.max_hz / target_hz);
+    if (max_len < min_len) max_len = min_len;
+
+    for (size_t len = min_len; len <= max_len; len++) {
+      double divisor = std::max(limits.source_hz / (target_hz * len),
+                                limits.source_hz / limits.max_hz);
+      ClockDivider div = closest_divider(divisor, limits);
+      double clock_hz = limits.source_hz / div.divisor();
+      if (clock_hz > limits.max_hz && len > min_len) continue;
+
+      double refresh_hz = clock_hz / len;
+      double error = (refresh_hz - target_hz) / target_hz;
+      if (std::abs(error) < std::abs(best.error)) {
+        best = {div, len, clock_hz, refresh_hz, error};
+        // far better than the accuracy of the crystal
+        if (std::abs(error) < 1e-9) break;
+      }
+    }
+    return best;
+  }
+
+}
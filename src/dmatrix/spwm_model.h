@@ -0,0 +1,292 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+#include "buffer_model.h"
+#include "display_model.h"
+
+namespace DMAtrix {
+
+  // Commands for S-PWM driver chips (ICN2053/FM6363 class), identified by
+  // the number of DCLK cycles for which LAT is high at the end of a shift.
+  // The command set follows the ICN2053; the register contents are a
+  // simplified model, which the emulator in test/local/spwm_chip.h matches.
+  namespace spwm {
+    constexpr size_t DATA_LATCH = 1;
+    constexpr size_t VSYNC = 3;
+    constexpr size_t PRE_ACTIVE = 14;
+    /// write config register reg (1 to 4)
+    constexpr size_t write_reg(size_t reg) { return 2 + 2 * reg; }
+
+    constexpr size_t channels = 16;  // outputs per chip
+    constexpr size_t reg_bits = 16;  // bits per register or channel
+  }  // namespace spwm
+
+  /// Buffer model for panels driven by S-PWM chips, which hold a frame in
+  /// internal SRAM and generate their own PWM, clocked by GCLK.
+  ///
+  /// Each data line drives a chain of D::data_words / 16 chips, and each
+  /// word of a display row is one chip output. The pins are as for
+  /// BufferModel, with OE driving GCLK and LE driving LAT, and the pin
+  /// driver clock driving DCLK.
+  ///
+  /// The buffer starts with a preamble writing the config registers (each
+  /// write preceded by PRE_ACTIVE), then uploads the frame with one
+  /// DATA_LATCH per (address, channel), and latches it with VSYNC; the chips
+  /// show it from the start of their next PWM frame. Throughout the buffer,
+  /// GCLK toggles every word, and the address lines follow the row the chips
+  /// are scanning. The PWM period of 2^num_bits GCLKs is split into sections,
+  /// and each row is shown once per section, so rows are refreshed sections
+  /// times as often as with BufferModel for the same clock and bit depth.
+  template <typename D>
+  struct SPWMBufferModel {
+    static_assert(D::data_words % spwm::channels == 0,
+                  "rows must be made of whole chips");
+
+    static constexpr size_t chips = D::data_words / spwm::channels;
+    static constexpr size_t scan_rows = 1 << D::addr_bits;
+    // words in one shift through a chain
+    static constexpr size_t shift_len = chips * spwm::reg_bits;
+    // GCLKs at the start of each row slot with the outputs off, while the
+    // address lines change
+    static constexpr size_t dead_gclks = 2;
+
+    size_t num_bits;
+    size_t sections;
+    // GCLKs per row in each section, excluding dead_gclks
+    size_t slot_gclks;
+
+    // where the pixel data and VSYNC start, the words in each PWM frame, and
+    // the whole buffer, which is a whole number of PWM frames
+    size_t data_offset;
+    size_t vsync_offset;
+    size_t scan_len;
+    size_t buf_len;
+
+    static constexpr int gclk_bit() { return 0; }
+    static constexpr int lat_bit() { return 1; }
+    static constexpr int addr_bit(size_t bit) { return 2 + bit; }
+    static constexpr int data_bit(size_t bit) { return 2 + D::addr_bits + bit; }
+    static constexpr int oe_bit() { return gclk_bit(); }
+
+    /// GCLK stopped, so the chips stop scanning
+    static constexpr uint32_t blank_word() { return 0; }
+
+    /// sections takes the place of min_pulse in the DisplayDriver
+    /// constructor, and must divide 2^num_bits; the buffer is padded with
+    /// whole PWM frames to be at least min_buf_len
+    SPWMBufferModel(size_t sections, size_t num_bits, size_t min_buf_len = 0)
+        : num_bits(num_bits),
+          sections(sections),
+          slot_gclks((1 << num_bits) / sections) {
+      assert(num_bits <= spwm::reg_bits && slot_gclks * sections ==
+                                               (size_t)1 << num_bits);
+
+      data_offset = 8 * shift_len;  // PRE_ACTIVE before each register
+      // LAT goes low for a word between the last DATA_LATCH and VSYNC
+      vsync_offset = data_offset + scan_rows * spwm::channels * shift_len + 1;
+      size_t upload_len = vsync_offset + spwm::VSYNC + 1;
+
+      scan_len = 2 * (dead_gclks + slot_gclks) * scan_rows * sections;
+      size_t len = std::max(upload_len, min_buf_len);
+      buf_len = (len + scan_len - 1) / scan_len * scan_len;
+    }
+
+    /// the value written to config register reg
+    uint32_t reg_value(size_t reg) const {
+      switch (reg) {
+        case 1:
+          return scan_rows - 1;
+        case 2:
+          return slot_gclks - 1;
+        case 3:
+          return dead_gclks;
+        case 4:
+          return sections - 1;
+      }
+      return 0;
+    }
+
+    /// position of bit (15 is the MSB) of chip in the shift starting at
+    /// start; the first bit shifted ends up in the last chip
+    static size_t shift_pos(size_t start, size_t chip, size_t bit) {
+      return start + (chips - 1 - chip) * spwm::reg_bits +
+             (spwm::reg_bits - 1 - bit);
+    }
+
+    /// start of the shift for one channel of every chip on address addr
+    size_t pixel_offset(size_t addr, size_t channel) const {
+      return data_offset + (addr * spwm::channels + channel) * shift_len;
+    }
+
+    /// the buffer can be split anywhere, but flips only make sense at the
+    /// end, so that the chips get a whole upload
+    std::vector<Segment> segments(size_t max_len, size_t align = 1) {
+      std::vector<Segment> res{{0, true}};
+      size_t len = std::max(max_len / align * align, align);
+      while (buf_len - res.back().start > max_len)
+        res.push_back({res.back().start + len, false});
+      return res;
+    }
+
+    template <typename Buffer>
+    void init_buffer(Buffer &buf) {
+      // GCLK rises on even words; the address changes at the start of each
+      // slot
+      for (size_t i = 0; i < buf_len; i++) {
+        size_t gclk = i % scan_len / 2;
+        size_t row = gclk / (dead_gclks + slot_gclks) % scan_rows;
+        buf[i] = ((i & 1) ? 0 : 1 << gclk_bit()) | (row << addr_bit(0));
+      }
+
+      for (size_t reg = 1; reg <= 4; reg++) {
+        size_t start = (2 * reg - 2) * shift_len;
+        command(buf, start, spwm::PRE_ACTIVE, 0);
+        command(buf, start + shift_len, spwm::write_reg(reg), reg_value(reg));
+      }
+
+      for (size_t addr = 0; addr < scan_rows; addr++)
+        for (size_t channel = 0; channel < spwm::channels; channel++)
+          command(buf, pixel_offset(addr, channel), spwm::DATA_LATCH, 0);
+
+      for (size_t i = 0; i < spwm::VSYNC; i++)
+        buf[vsync_offset + i] |= 1 << lat_bit();
+    }
+
+    /// shift value into every chip on every data line starting at start,
+    /// with LAT high for the last lat_len words
+    template <typename Buffer>
+    void command(Buffer &buf, size_t start, size_t lat_len, uint32_t value) {
+      uint32_t mask = ((1u << D::data_bits) - 1) << data_bit(0);
+      for (size_t chip = 0; chip < chips; chip++)
+        for (size_t bit = 0; bit < spwm::reg_bits; bit++) {
+          size_t pos = shift_pos(start, chip, bit);
+          buf[pos] = (buf[pos] & ~mask) | (-((value >> bit) & 1) & mask);
+        }
+
+      for (size_t i = shift_len - lat_len; i < shift_len; i++)
+        buf[start + i] |= 1 << lat_bit();
+    }
+
+    /// write the level for one output
+    template <typename Buffer>
+    void write_level(Buffer &buf, size_t addr, size_t line, size_t word,
+                     uint32_t level) {
+      size_t start = pixel_offset(addr, word % spwm::channels);
+      size_t chip = word / spwm::channels;
+      uint32_t mask = 1 << data_bit(line);
+
+      for (size_t bit = 0; bit < spwm::reg_bits; bit++) {
+        size_t pos = shift_pos(start, chip, bit);
+        buf[pos] = (buf[pos] & ~mask) | (-((level >> bit) & 1) & mask);
+      }
+    }
+
+    template <typename T, size_t num_bits_value, typename Buffer>
+    void write_color(Buffer &buf, size_t row, size_t col, size_t color,
+                     T value) {
+      DataAddr addr = D::encode(row, col, color);
+      uint32_t level = num_bits_value >= num_bits
+                           ? (uint32_t)value >> (num_bits_value - num_bits)
+                           : (uint32_t)value << (num_bits - num_bits_value);
+      write_level(buf, addr.addr, addr.bit, addr.word, level);
+    }
+
+    template <typename T, size_t num_bits_value, typename Buffer>
+    void write_rgb(Buffer &buf, size_t row, size_t col, T r, T g, T b) {
+      write_color<T, num_bits_value>(buf, row, col, 0, r);
+      write_color<T, num_bits_value>(buf, row, col, 1, g);
+      write_color<T, num_bits_value>(buf, row, col, 2, b);
+    }
+
+    template <typename T, size_t num_bits_value, typename Buffer>
+    void fill_span(Buffer &buf, size_t row, size_t col, size_t len, T r, T g,
+                   T b) {
+      for (size_t i = 0; i < len; i++)
+        write_rgb<T, num_bits_value>(buf, row, col + i, r, g, b);
+    }
+
+    template <typename T, size_t num_bits_value, typename Buffer>
+    void write_span(Buffer &buf, size_t row, size_t col, size_t len,
+                    const T *rgb) {
+      for (size_t i = 0; i < len; i++)
+        write_rgb<T, num_bits_value>(buf, row, col + i, rgb[D::colors * i],
+                                     rgb[D::colors * i + 1],
+                                     rgb[D::colors * i + 2]);
+    }
+
+    template <typename T, size_t num_bits_value, typename Buffer>
+    void write_image(Buffer &buf, const T *rgb) {
+      for (size_t row = 0; row < D::rows; row++)
+        write_span<T, num_bits_value>(buf, row, 0, D::cols,
+                                      rgb + row * D::cols * D::colors);
+    }
+
+    /// copy the levels for one (addr, channel) shift from frame (a
+    /// BitplaneFramebuffer) into buf
+    template <typename Buffer, typename Frame>
+    void write_shift(Buffer &buf, const Frame &frame, size_t addr,
+                     size_t channel) {
+      for (size_t word = channel; word < D::data_words;
+           word += spwm::channels)
+        for (size_t line = 0; line < D::data_bits; line++) {
+          uint32_t level = 0;
+          for (size_t bit = 0; bit < num_bits; bit++)
+            level |= ((frame.plane(bit, addr)[word] >> line) & 1) << bit;
+          write_level(buf, addr, line, word, level);
+        }
+    }
+
+    /// copy the levels from frame (a BitplaneFramebuffer) into buf
+    template <typename Buffer, typename Frame>
+    void write_frame(Buffer &buf, const Frame &frame) {
+      for (size_t addr = 0; addr < scan_rows; addr++)
+        for (size_t channel = 0; channel < spwm::channels; channel++)
+          write_shift(buf, frame, addr, channel);
+    }
+
+    /// Write frame into buf while it is being output, so that the chips
+    /// never latch a mix of two frames. As in
+    /// BufferModel::write_frame_behind, each shift is written only once
+    /// position() shows that its DATA_LATCH has been output, so that the
+    /// next upload is all new; if the DMA is already past the first shift,
+    /// this first waits for the next upload, so flip can take up to two
+    /// refreshes. Each shift must then be written before the DMA comes round
+    /// to it again, so writing the whole frame must take less than a
+    /// refresh. position must take at least two values per refresh, and
+    /// must be polled more often than once per refresh.
+    template <typename Buffer, typename Frame, typename Position>
+    void write_frame_behind(Buffer &buf, const Frame &frame,
+                            Position position) {
+      size_t last = position();
+      if (pixel_offset(0, 0) + shift_len <= last) {
+        size_t pos;
+        while ((pos = position()) >= last) last = pos;
+        last = pos;
+      }
+
+      for (size_t addr = 0; addr < scan_rows; addr++)
+        for (size_t channel = 0; channel < spwm::channels; channel++) {
+          // once the position wraps around, the rest have all been latched
+          while (pixel_offset(addr, channel) + shift_len > last) {
+            size_t pos = position();
+            if (pos < last) {
+              last = SIZE_MAX;
+              break;
+            }
+            last = pos;
+          }
+          write_shift(buf, frame, addr, channel);
+        }
+    }
+
+    /// copy the pixel data from src to dst
+    template <typename Buffer>
+    void copy_data(Buffer &dst, Buffer &src) {
+      copy_words(dst, src, data_offset, vsync_offset);
+    }
+  };
+
+}
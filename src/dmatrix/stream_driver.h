@@ -0,0 +1,143 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include "driver.h"
+#include "framebuffer.h"
+
+namespace DMAtrix {
+
+  /// view of a buffer starting at some offset
+  template <typename Buffer>
+  struct OffsetBuffer {
+    Buffer &buf;
+    size_t offset;
+
+    decltype(auto) operator[](size_t idx) { return buf[offset + idx]; }
+  };
+
+  /// Display driver which keeps the image in a BitplaneFramebuffer and
+  /// generates the waveform on the fly into a small ring of DMA bounce buffers,
+  /// so that the DMA memory required does not depend on the display size or
+  /// bit depth.
+  ///
+  /// The stream driver calls back to fill each chunk of the ring in order,
+  /// just after the DMA has finished with it; see ESP32I2SStream.
+  ///
+  /// With adaptive set, a schedule is built for each number of bitplanes, and
+  /// each flip picks the shortest one which shows every bit set in the frame.
+  /// Each schedule shows every bitplane for the same fraction of the refresh
+  /// as the full one, so brightness is unchanged; dim frames, whose high
+  /// bitplanes are empty, are refreshed faster by shortening every pulse, so
+  /// this only helps with a min_pulse above 1. Without double buffering,
+  /// pixels drawn after a flip are shown without any bits above that schedule
+  /// until the next flip.
+  template <typename Display, template <size_t> typename StreamDriver,
+            bool double_buffered>
+  struct StreamingDisplayDriver {
+    using PinsT = Pins<Display>;
+    using FramebufferT = BitplaneFramebuffer<Display>;
+    static constexpr size_t num_buffers = double_buffered ? 2 : 1;
+    size_t back_buffer = double_buffered ? 1 : 0;
+
+    using StreamDriverT = StreamDriver<PinsT::num_bits>;
+    using DriverConfig = typename StreamDriverT::Config;
+    using Chunk = typename StreamDriverT::Chunk;
+    StreamDriverT pin_driver;
+
+    BufferModel<Display> buffer_model;
+    std::vector<FramebufferT> framebuffers;
+
+    // with adaptive set, schedules[i] shows the lowest i + 1 bitplanes, and
+    // buffer_model shows them all
+    bool adaptive;
+    std::vector<BufferModel<Display>> schedules;
+    // the schedule being output, and the one to switch to on the next flip
+    BufferModel<Display> *front_model;
+    BufferModel<Display> *volatile pending_model;
+
+    // state used by the fill callback: the buffer being output, the position
+    // in the waveform of the next chunk, and whether the front buffer should
+    // be switched at the start of the next refresh
+    size_t front_buffer = 0;
+    size_t stream_pos = 0;
+    volatile bool flip_pending = false;
+
+    /// min_buf_len pads the buffer to fix the refresh rate (see
+    /// solve_refresh_rate); adaptive schedules are scaled from the padded
+    /// length
+    StreamingDisplayDriver(PinsT pins, size_t min_pulse, size_t num_bits,
+                           DriverConfig driver_config = {},
+                           size_t min_buf_len = 0, bool adaptive = false)
+        : buffer_model(min_pulse, num_bits, min_buf_len),
+          framebuffers(num_buffers, FramebufferT(num_bits)),
+          adaptive(adaptive),
+          front_model(&buffer_model),
+          pending_model(&buffer_model) {
+      if (adaptive)
+        for (size_t bits = 1; bits < num_bits; bits++)
+          schedules.push_back(adaptive_schedule(min_pulse, bits));
+
+      pin_driver.setup(data_pin_map(pins), pins.clk, driver_config,
+                       fill_chunk, (void *)this);
+    }
+
+    /// Schedule for the lowest bits bitplanes with the same duty cycle per
+    /// bitplane as buffer_model: pulses of pulse << bit clocks in a refresh
+    /// pulse / min_pulse times as long, padded out, using the shortest pulse
+    /// which fits.
+    BufferModel<Display> adaptive_schedule(size_t min_pulse, size_t bits) {
+      size_t full_len = buffer_model.buf_len;
+      for (size_t pulse = 1;; pulse++) {
+        size_t len = (full_len * pulse + min_pulse / 2) / min_pulse;
+        BufferModel<Display> model(
+            BufferModel<Display>::binary_weights(pulse, bits), len);
+        if (model.buf_len == len || pulse >= min_pulse) return model;
+      }
+    }
+
+    static void fill_chunk(void *arg, Chunk &chunk, size_t len) {
+      ((StreamingDisplayDriver *)arg)->fill(chunk, len);
+    }
+
+    void fill(Chunk &chunk, size_t len) {
+      // a short adaptive schedule may wrap more than once per chunk
+      for (size_t done = 0; done < len;) {
+        // switch buffers and schedules exactly at the start of a refresh
+        if (flip_pending && stream_pos == 0) {
+          front_buffer = double_buffered ? back_buffer ^ 1 : 0;
+          front_model = pending_model;
+          flip_pending = false;
+        }
+
+        size_t n = std::min(len - done, front_model->buf_len - stream_pos);
+        OffsetBuffer<Chunk> out{chunk, done};
+        front_model->render(out, stream_pos, n, framebuffers[front_buffer]);
+        done += n;
+        stream_pos = (stream_pos + n) % front_model->buf_len;
+      }
+    }
+
+    template <typename T = uint8_t, int num_bits_value = 8>
+    void write_rgb(size_t row, size_t col, T r, T g, T b) {
+      framebuffers[back_buffer].template write_rgb<T, num_bits_value>(
+          row, col, r, g, b);
+    }
+
+    /// the shortest schedule which shows every bit set in frame
+    BufferModel<Display> *schedule_for(const FramebufferT &frame) {
+      size_t bits = std::max(frame.used_bits(), (size_t)1);
+      return bits < buffer_model.num_bits ? &schedules[bits - 1]
+                                          : &buffer_model;
+    }
+
+    void flip() {
+      if (adaptive) pending_model = schedule_for(framebuffers[back_buffer]);
+      if (double_buffered) back_buffer ^= 1;
+      if (double_buffered || adaptive) flip_pending = true;
+    }
+
+    bool flip_done() { return !flip_pending; }
+  };
+
+}
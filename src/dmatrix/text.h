@@ -0,0 +1,166 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "display_model.h"
+
+namespace DMAtrix {
+
+  /// A fixed-size bitmap font. Glyph i is for character (first + i), and is
+  /// height rows starting at bitmap[i * height]; bit x of a row is set if
+  /// column x (counting from the left) is lit. Characters outside the font
+  /// are drawn as spaces.
+  struct Font {
+    unsigned char first;
+    size_t count;
+    size_t width;
+    size_t height;
+    const uint32_t *bitmap;
+  };
+
+  /// Text drawing for one font and color on display D, with the glyphs and
+  /// color pre-encoded so that drawing a character is a few masked stores per
+  /// bitplane for each run of lit pixels, rather than encoding each pixel.
+  ///
+  /// Glyphs are stored as runs of lit pixels. For each display row, the color
+  /// is stored as the data bits to clear and set in each bitplane, for each
+  /// group of colors which share words (see SpanLayout). Masks are relative
+  /// to the first data bit, as in BitplaneFramebuffer. Rows which the display
+  /// doesn't lay out contiguously are drawn pixel by pixel.
+  template <typename D>
+  struct GlyphCache {
+    struct Run {
+      uint8_t row, col, len;
+    };
+
+    struct ColorGroup {
+      size_t addr;
+      size_t word;  // word for column 0
+      uint32_t clear;
+    };
+
+    Font font;
+    size_t num_bits;
+
+    std::vector<Run> runs;
+    std::vector<size_t> glyph_runs;  // start of each glyph in runs
+
+    std::vector<size_t> row_groups;  // start of each row in groups
+    std::vector<ColorGroup> groups;
+    std::vector<uint32_t> set_masks;  // num_bits masks per group
+
+    // false if the color for a row isn't contiguous, in which case text on
+    // that row is drawn pixel by pixel
+    std::vector<bool> row_ok;
+    // the color with 16 bits per value, for drawing pixel by pixel
+    uint16_t color16[D::colors];
+
+    /// r, g and b have num_bits_value bits, as in write_rgb
+    GlyphCache(const Font &font, size_t num_bits, uint32_t r, uint32_t g,
+               uint32_t b, size_t num_bits_value = 8)
+        : font(font), num_bits(num_bits) {
+      for (size_t glyph = 0; glyph < font.count; glyph++) {
+        glyph_runs.push_back(runs.size());
+        for (size_t row = 0; row < font.height; row++) {
+          uint32_t bits = font.bitmap[glyph * font.height + row];
+          for (size_t col = 0; col < font.width;) {
+            if (!((bits >> col) & 1)) {
+              col++;
+              continue;
+            }
+            size_t len = 0;
+            while (col + len < font.width && ((bits >> (col + len)) & 1))
+              len++;
+            runs.push_back({(uint8_t)row, (uint8_t)col, (uint8_t)len});
+            col += len;
+          }
+        }
+      }
+      glyph_runs.push_back(runs.size());
+
+      uint32_t values[D::colors] = {r, g, b};
+      for (size_t color = 0; color < D::colors; color++)
+        color16[color] = num_bits_value <= 16
+                             ? values[color] << (16 - num_bits_value)
+                             : values[color] >> (num_bits_value - 16);
+      for (size_t row = 0; row < D::rows; row++) {
+        row_groups.push_back(groups.size());
+
+        SpanLayout<D> layout(row, 0, D::cols);
+        bool ok = true;
+        for (size_t color = 0; color < D::colors; color++)
+          ok = ok && layout.contiguous[color];
+        row_ok.push_back(ok);
+
+        for (size_t group_idx = 0; group_idx < layout.num_groups;
+             group_idx++) {
+          auto &group = layout.groups[group_idx];
+
+          uint32_t clear = 0;
+          for (size_t i = 0; i < group.num_colors; i++)
+            clear |= 1 << layout.bits[group.colors[i]];
+          groups.push_back({group.addr.addr, group.addr.word, clear});
+
+          for (size_t bit = 0; bit < num_bits; bit++) {
+            int value_bit = (int)bit + ((int)num_bits_value - (int)num_bits);
+            uint32_t set = 0;
+            for (size_t i = 0; value_bit >= 0 && i < group.num_colors; i++) {
+              size_t color = group.colors[i];
+              if ((values[color] >> value_bit) & 1)
+                set |= 1 << layout.bits[color];
+            }
+            set_masks.push_back(set);
+          }
+        }
+      }
+      row_groups.push_back(groups.size());
+    }
+
+    /// Draw character c with its top left corner at (row, col), clipped to
+    /// the display. Only lit pixels are drawn. update(bit, addr, word, len,
+    /// clear, set) is called to modify each run of words; see
+    /// BitplaneFramebuffer::update_words. On rows which aren't contiguous,
+    /// pixel(row, col, r, g, b) is called instead for each lit pixel, with
+    /// 16 bit values as for write_rgb<uint16_t, 16>.
+    template <typename Update, typename Pixel>
+    void draw_char(int row, int col, unsigned char c, Update update,
+                   Pixel pixel) {
+      if (c < font.first || c >= font.first + font.count) return;
+      size_t glyph = c - font.first;
+
+      for (size_t i = glyph_runs[glyph]; i < glyph_runs[glyph + 1]; i++) {
+        const Run &run = runs[i];
+        int run_row = row + run.row;
+        int start = std::max(col + run.col, 0);
+        int end = std::min(col + run.col + run.len, (int)D::cols);
+        if (run_row < 0 || run_row >= (int)D::rows || start >= end)
+          continue;
+
+        if (!row_ok[run_row]) {
+          for (int px_col = start; px_col < end; px_col++)
+            pixel(run_row, px_col, color16[0], color16[1], color16[2]);
+          continue;
+        }
+
+        for (size_t g = row_groups[run_row]; g < row_groups[run_row + 1];
+             g++) {
+          const ColorGroup &group = groups[g];
+          for (size_t bit = 0; bit < num_bits; bit++)
+            update(bit, group.addr, group.word + start, end - start,
+                   group.clear, set_masks[g * num_bits + bit]);
+        }
+      }
+    }
+
+    /// draw a string, returning the column after the last character
+    template <typename Update, typename Pixel>
+    int draw_text(int row, int col, const char *text, Update update,
+                  Pixel pixel) {
+      for (; *text; text++, col += font.width)
+        draw_char(row, col, *text, update, pixel);
+      return col;
+    }
+  };
+
+}
@@ -0,0 +1,275 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include "display_model.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace DMAtrix {
+
+  // Bit transpose kernels. Each has static transpose methods which take n <=
+  // 32 values and set planes[b] such that bit i is bit b of values[i], for
+  // each bit b of the value type. This is the core of converting pixel values
+  // to bitplanes: value bits become planes, and pixels become bit positions.
+
+  /// one bit at a time; the reference for the others
+  struct TransposeScalar {
+    template <typename T>
+    static void transpose(const T *values, size_t n, uint32_t *planes) {
+      for (size_t b = 0; b < sizeof(T) * 8; b++) {
+        planes[b] = 0;
+        for (size_t i = 0; i < n; i++)
+          planes[b] |= (uint32_t)((values[i] >> b) & 1) << i;
+      }
+    }
+  };
+
+  /// portable SWAR kernels: 8x8 blocks in a 64 bit word, and 32x32 in place
+  struct TransposeSWAR {
+    /// transpose the 8x8 bit matrix with row i in byte i of x
+    static uint64_t transpose8x8(uint64_t x) {
+      uint64_t t;
+      t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+      x = x ^ t ^ (t << 7);
+      t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+      x = x ^ t ^ (t << 14);
+      t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+      x = x ^ t ^ (t << 28);
+      return x;
+    }
+
+    /// transpose the 32x32 bit matrix with row i in a[i] in place, so that
+    /// bit j of a[i] moves to bit i of a[j]
+    static void transpose32x32(uint32_t *a) {
+      uint32_t m = 0x0000FFFF;
+      for (size_t j = 16; j != 0; j >>= 1, m ^= (m << j))
+        for (size_t k = 0; k < 32; k = (k + j + 1) & ~j) {
+          uint32_t t = ((a[k] >> j) ^ a[k + j]) & m;
+          a[k] ^= t << j;
+          a[k + j] ^= t;
+        }
+    }
+
+    static void transpose(const uint8_t *values, size_t n, uint32_t *planes) {
+      for (size_t b = 0; b < 8; b++) planes[b] = 0;
+
+      for (size_t block = 0; block * 8 < n; block++) {
+        uint64_t x = 0;
+        size_t block_n = std::min<size_t>(8, n - block * 8);
+        for (size_t i = 0; i < block_n; i++)
+          x |= (uint64_t)values[block * 8 + i] << (8 * i);
+
+        x = transpose8x8(x);
+        for (size_t b = 0; b < 8; b++)
+          planes[b] |= (uint32_t)((x >> (8 * b)) & 0xff) << (8 * block);
+      }
+    }
+
+    static void transpose(const uint16_t *values, size_t n, uint32_t *planes) {
+      uint32_t a[32] = {0};
+      for (size_t i = 0; i < n; i++) a[i] = values[i];
+      transpose32x32(a);
+      for (size_t b = 0; b < 16; b++) planes[b] = a[b];
+    }
+  };
+
+#if defined(__SSE2__)
+  /// SSE2: pmovmskb extracts the top bit of 16 bytes at once
+  struct TransposeSSE2 : TransposeSWAR {
+    static void transpose16(__m128i v, uint32_t *planes, size_t shift) {
+      for (size_t b = 8; b-- > 0;) {
+        planes[b] |= (uint32_t)_mm_movemask_epi8(v) << shift;
+        v = _mm_add_epi8(v, v);
+      }
+    }
+
+    static __m128i load(const uint8_t *values, size_t n) {
+      if (n >= 16) return _mm_loadu_si128((const __m128i *)values);
+      uint8_t tmp[16] = {0};
+      memcpy(tmp, values, n);
+      return _mm_loadu_si128((const __m128i *)tmp);
+    }
+
+    static void transpose(const uint8_t *values, size_t n, uint32_t *planes) {
+      for (size_t b = 0; b < 8; b++) planes[b] = 0;
+      transpose16(load(values, n), planes, 0);
+      if (n > 16) transpose16(load(values + 16, n - 16), planes, 16);
+    }
+
+    static void transpose(const uint16_t *values, size_t n, uint32_t *planes) {
+      // split into low and high bytes, and transpose each
+      uint8_t low[32], high[32];
+      for (size_t i = 0; i < n; i++) {
+        low[i] = values[i] & 0xff;
+        high[i] = values[i] >> 8;
+      }
+      transpose(low, n, planes);
+      transpose(high, n, planes + 8);
+    }
+  };
+#endif
+
+#if defined(__AVX2__)
+  /// AVX2: as TransposeSSE2, but 32 bytes at once
+  struct TransposeAVX2 : TransposeSSE2 {
+    using TransposeSSE2::transpose;
+
+    static void transpose(const uint8_t *values, size_t n, uint32_t *planes) {
+      uint8_t tmp[32] = {0};
+      memcpy(tmp, values, n);
+      __m256i v = _mm256_loadu_si256((const __m256i *)tmp);
+
+      for (size_t b = 8; b-- > 0;) {
+        planes[b] = (uint32_t)_mm256_movemask_epi8(v);
+        v = _mm256_add_epi8(v, v);
+      }
+    }
+  };
+#endif
+
+  // The ESP32-S3 PIE vector instructions are only usable from assembly, and
+  // this library doesn't support the S3 yet, so Xtensa targets use SWAR.
+#if defined(__AVX2__)
+  using TransposeBest = TransposeAVX2;
+#elif defined(__SSE2__)
+  using TransposeBest = TransposeSSE2;
+#else
+  using TransposeBest = TransposeSWAR;
+#endif
+
+  /// Where the value on each data line comes from for displays which lay out
+  /// pixels like FullDisplay: at address addr and word w, data line k carries
+  /// row (addr + row_offset[k]), column w, color[k].
+  template <typename D>
+  struct TransposeLayout {
+    size_t row_offset[D::data_bits];
+    size_t color[D::data_bits];
+    bool supported = true;
+
+    TransposeLayout() {
+      for (size_t row = 0; row < D::rows; row++)
+        for (size_t color = 0; color < D::colors; color++) {
+          DataAddr addr = D::encode(row, 0, color);
+          row_offset[addr.bit] = row - addr.addr;
+          this->color[addr.bit] = color;
+        }
+
+      for (size_t row = 0; row < D::rows; row++)
+        for (size_t col = 0; col < D::cols; col++)
+          for (size_t color = 0; color < D::colors; color++) {
+            DataAddr addr = D::encode(row, col, color);
+            if (addr.word != col || row_offset[addr.bit] != row - addr.addr ||
+                this->color[addr.bit] != color)
+              supported = false;
+          }
+    }
+  };
+
+  /// Transpose a whole image into bitplane words. rgb holds interleaved
+  /// (r, g, b) values in row-major order. For each address and word,
+  /// out(addr, word, planes) is called, where bit k of planes[b] is bit b of
+  /// the value on data line k. As many words as fit are transposed at once.
+  /// The layout must be supported.
+  template <typename D, typename Kernel, typename T, typename Out>
+  void transpose_image(const TransposeLayout<D> &layout, const T *rgb,
+                       Out out) {
+    constexpr size_t value_bits = sizeof(T) * 8;
+    constexpr size_t batch = 32 / D::data_bits;
+    constexpr uint32_t mask = (uint32_t)((1ull << D::data_bits) - 1);
+
+    T values[32];
+    uint32_t planes[value_bits], word_planes[value_bits];
+
+    for (size_t addr = 0; addr < (1 << D::addr_bits); addr++) {
+      const T *rows[D::data_bits];
+      for (size_t k = 0; k < D::data_bits; k++)
+        rows[k] = rgb + (addr + layout.row_offset[k]) * D::cols * D::colors +
+                  layout.color[k];
+
+      for (size_t word = 0; word < D::data_words; word += batch) {
+        size_t n = std::min(batch, D::data_words - word);
+        for (size_t j = 0; j < n; j++)
+          for (size_t k = 0; k < D::data_bits; k++)
+            values[j * D::data_bits + k] = rows[k][(word + j) * D::colors];
+
+        Kernel::transpose(values, n * D::data_bits, planes);
+
+        for (size_t j = 0; j < n; j++) {
+          for (size_t b = 0; b < value_bits; b++)
+            word_planes[b] = (planes[b] >> (j * D::data_bits)) & mask;
+          out(addr, word + j, word_planes);
+        }
+      }
+    }
+  }
+
+  /// Transpose bitplane words back into values, as many words at once as
+  /// fit, in 8x8 blocks with TransposeSWAR::transpose8x8 (a transpose is its
+  /// own inverse, and this is quicker than 32x32 for 8 or 16 bit values). For
+  /// each word w in [begin, end), in(w, planes) is called to fill planes[b]
+  /// for each bit b of T, as transpose_image passes them to out, and then
+  /// out(w, values) is called, where values[k] is the value on data line k.
+  template <typename D, typename T, typename In, typename Out>
+  void untranspose_words(size_t begin, size_t end, In in, Out out) {
+    constexpr size_t value_bits = sizeof(T) * 8;
+    static_assert(value_bits <= 32, "values must fit in a plane");
+    constexpr size_t batch = 32 / D::data_bits;
+
+    uint32_t a[32], planes[value_bits];
+    for (size_t word = begin; word < end; word += batch) {
+      size_t n = std::min(batch, end - word);
+      std::fill(a, a + 32, 0);
+      for (size_t j = 0; j < n; j++) {
+        in(word + j, planes);
+        for (size_t b = 0; b < value_bits; b++)
+          a[b] |= planes[b] << (j * D::data_bits);
+      }
+
+      // 8x8 blocks: byte g of the values on lines 8q to 8q + 7 comes from
+      // bits 8q to 8q + 7 of planes 8g to 8g + 7
+      uint32_t values[32] = {0};
+      size_t lines = n * D::data_bits;
+      for (size_t g = 0; g < value_bits / 8; g++)
+        for (size_t q = 0; q * 8 < lines; q++) {
+          uint64_t x = 0;
+          for (size_t b = 0; b < 8; b++)
+            x |= (uint64_t)((a[8 * g + b] >> (8 * q)) & 0xff) << (8 * b);
+          x = TransposeSWAR::transpose8x8(x);
+          for (size_t i = 0; i < 8; i++)
+            values[8 * q + i] |= (uint32_t)((x >> (8 * i)) & 0xff) << (8 * g);
+        }
+
+      for (size_t j = 0; j < n; j++)
+        out(word + j, values + j * D::data_bits);
+    }
+  }
+
+  /// The inverse of transpose_image: for each address and word,
+  /// in(addr, word, planes) is called to fill planes as out receives them,
+  /// and the values are written to rgb. The layout must be supported.
+  template <typename D, typename T, typename In>
+  void untranspose_image(const TransposeLayout<D> &layout, T *rgb, In in) {
+    for (size_t addr = 0; addr < (1 << D::addr_bits); addr++) {
+      T *rows[D::data_bits];
+      for (size_t k = 0; k < D::data_bits; k++)
+        rows[k] = rgb + (addr + layout.row_offset[k]) * D::cols * D::colors +
+                  layout.color[k];
+
+      untranspose_words<D, T>(
+          0, D::data_words,
+          [&](size_t word, uint32_t *planes) { in(addr, word, planes); },
+          [&](size_t word, const uint32_t *values) {
+            for (size_t k = 0; k < D::data_bits; k++)
+              rows[k][word * D::colors] = (T)values[k];
+          });
+    }
+  }
+
+}
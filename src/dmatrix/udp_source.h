@@ -0,0 +1,71 @@
+#pragma once
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstdint>
+
+namespace DMAtrix {
+
+  /// Datagram source for Ingest which reads from a non-blocking UDP socket.
+  /// Uses BSD sockets, so works on hosts and with lwIP on the ESP32.
+  struct UDPSource {
+    int fd = -1;
+
+    UDPSource() = default;
+    UDPSource(const UDPSource &) = delete;
+    UDPSource &operator=(const UDPSource &) = delete;
+
+    /// the socket is moved, leaving other closed
+    UDPSource(UDPSource &&other) : fd(other.fd) { other.fd = -1; }
+    UDPSource &operator=(UDPSource &&other) {
+      if (this != &other) {
+        close();
+        fd = other.fd;
+        other.fd = -1;
+      }
+      return *this;
+    }
+
+    /// listen on port on all interfaces (6454 for Art-Net, 5568 for E1.31);
+    /// returns false on error
+    bool open(uint16_t port) {
+      fd = socket(AF_INET, SOCK_DGRAM, 0);
+      if (fd < 0) return false;
+
+      sockaddr_in addr = {};
+      addr.sin_family = AF_INET;
+      addr.sin_addr.s_addr = htonl(INADDR_ANY);
+      addr.sin_port = htons(port);
+
+      if (bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0 ||
+          fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) < 0) {
+        close();
+        return false;
+      }
+      return true;
+    }
+
+    void close() {
+      if (fd >= 0) ::close(fd);
+      fd = -1;
+    }
+
+    /// the port actually bound, for when open is called with port 0
+    uint16_t port() const {
+      sockaddr_in addr = {};
+      socklen_t len = sizeof(addr);
+      getsockname(fd, (sockaddr *)&addr, &len);
+      return ntohs(addr.sin_port);
+    }
+
+    size_t receive(uint8_t *buf, size_t len) {
+      ssize_t res = recv(fd, buf, len, 0);
+      return res > 0 ? res : 0;
+    }
+
+    ~UDPSource() { close(); }
+  };
+
+}
@@ -0,0 +1,399 @@
+#pragma once
+
+#include <dmatrix/buffer_model.h>
+#include <dmatrix/cow_buffer.h>
+#include <dmatrix/display_model.h>
+#include <dmatrix/flip_queue.h>
+
+#include <Eigen/Core>
+#include <unsupported/Eigen/CXX11/Tensor>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "catch.hpp"
+
+using Image = Eigen::Tensor<unsigned int, 3>;
+
+/// decode the image displayed by a looping waveform. The waveform is run
+/// twice, and only the second pass is used, so that pulses which wrap around
+/// the end of the buffer are decoded correctly.
+template <typename D, typename Buffer>
+Image decode_waveform(const Buffer &buffer) {
+  using namespace DMAtrix;
+
+  Image res((int)D::rows, (int)D::cols, (int)D::colors);
+  res.setZero();
+
+  // state of shift register on LE
+  std::vector<unsigned int> shift_reg_front(D::data_words);
+  // circular buffer with for the non-visible shift register
+  std::vector<unsigned int> shift_reg_back(D::data_words);
+  size_t shift_reg_ptr = 0;
+
+  unsigned int oe_clocks = 0;
+  unsigned int oe_addr = 0;
+
+  for (size_t pass = 0; pass < 2; pass++)
+    for (auto &x : buffer) {
+      bool oe = !(x & 1);
+      bool le = (x >> 1) & 1;
+      unsigned int addr = (x >> 2) & ((1 << D::addr_bits) - 1);
+      unsigned int data =
+          (x >> (2 + D::addr_bits)) & ((1 << D::data_bits) - 1);
+
+      shift_reg_back[shift_reg_ptr] = data;
+
+      if (oe) {
+        REQUIRE(!le);
+
+        // addr is consistent curing oe pulse
+        if (oe_clocks == 0)
+          oe_addr = addr;
+        else
+          REQUIRE(addr == oe_addr);
+
+        oe_clocks++;
+      } else {
+        if (oe_clocks) {
+          // we've finished an oe pulse, with shift_reg_front loaded into the
+          // column drivers (because le was not asserted during the pulse) and
+          // the address lines set to oe_addr
+
+          // where the display was lit during this oe pulse, brighten the
+          // result
+          if (pass == 1)
+            for (size_t row = 0; row < D::rows; row++)
+              for (size_t col = 0; col < D::cols; col++)
+                for (size_t color = 0; color < D::colors; color++) {
+                  DataAddr dataaddr = D::encode(row, col, color);
+                  if (dataaddr.addr == oe_addr &&
+                      ((shift_reg_front[dataaddr.word] >> dataaddr.bit) & 1))
+                    res((int)row, (int)col, (int)color) += oe_clocks;
+                }
+
+          oe_clocks = 0;
+        }
+      }
+
+      if (le)
+        for (size_t i = 0; i < D::data_words; i++)
+          shift_reg_front[i] =
+              shift_reg_back[(shift_reg_ptr + D::data_words - i) %
+                             D::data_words];
+
+      shift_reg_ptr = (shift_reg_ptr + 1) % D::data_words;
+    }
+
+  return res;
+}
+
+template <size_t num_pins, size_t num_buffers>
+struct DummyDriver {
+  using dtype = uint32_t;
+  std::array<std::vector<dtype>, num_buffers> buffers;
+
+  struct Config {
+    bool autostart = true;
+  };
+
+  // the buffer being displayed; flips happen immediately
+  size_t front_buffer = 0;
+  bool started = false;
+
+  static constexpr size_t segment_align = 1;
+  static size_t max_segment_len(const Config &config) { return SIZE_MAX; }
+
+  void setup(std::array<int, num_pins> data_pins, int clk_pin, Config config,
+             size_t size, const std::vector<DMAtrix::Segment> &segments) {
+    for (auto &buffer : buffers) buffer.resize(size);
+    if (config.autostart) start();
+  }
+
+  void start() { started = true; }
+
+  uint32_t flips = 0;
+
+  uint32_t flip_to(size_t buf_idx, bool low_latency = false) {
+    front_buffer = buf_idx;
+    return ++flips;
+  }
+
+  bool flip_done() { return true; }
+  bool flip_done(uint32_t seq) { return true; }
+
+  /// there is no DMA, so the whole buffer can always be written
+  size_t read_position() { return buffers[front_buffer].size(); }
+
+  bool blanked = false;
+  void blank(dtype word, int clkspeed_hz = 0) { blanked = true; }
+  void unblank() { blanked = false; }
+
+  /// decode the image in buffer[buf]
+  template <typename D>
+  Image decode(size_t buf) {
+    return decode_waveform<D>(buffers[buf]);
+  }
+};
+
+/// Pin driver which simulates the DMA: the output advances only when run is
+/// called, and flips use FlipQueue as the ESP32 driver does, with the end of
+/// each segment (descriptor) linked to the next segment to output.
+template <size_t num_pins, size_t num_buffers>
+struct SimDriver {
+  using dtype = uint32_t;
+  std::array<std::vector<dtype>, num_buffers> buffers;
+
+  struct Config {
+    bool autostart = true;
+    // maximum segment length, or 0 for one segment per buffer
+    size_t segment_len = 0;
+    // only enable the interrupt while flips are pending, as on the ESP32
+    bool eof_on_demand = false;
+  };
+
+  static constexpr size_t segment_align = 1;
+  static size_t max_segment_len(const Config &config) {
+    return config.segment_len ? config.segment_len : SIZE_MAX;
+  }
+
+  std::vector<DMAtrix::Segment> segments;
+  // for each buffer and segment, the buffer which its end links to
+  std::array<std::vector<size_t>, num_buffers> next;
+  bool running = false;
+  size_t current = 0, segment = 0, pos = 0;
+  DMAtrix::FlipQueue<num_buffers> flips;
+
+  // everything output so far, and the output index at which each buffer
+  // started (or was switched to) being output
+  std::vector<dtype> output;
+  std::vector<std::pair<size_t, size_t>> starts;
+
+  // the simulated end-of-buffer interrupt: whether it is enabled, whether
+  // the event is latched, and the number of times it ran
+  bool eof_on_demand = false, eof_enabled = true, eof_raw = false;
+  size_t isr_count = 0;
+
+  void setup(std::array<int, num_pins> data_pins, int clk_pin, Config config,
+             size_t size, const std::vector<DMAtrix::Segment> &segments) {
+    this->segments = segments;
+    eof_on_demand = config.eof_on_demand;
+    eof_enabled = !eof_on_demand;
+    for (size_t i = 0; i < num_buffers; i++) {
+      buffers[i].resize(size);
+      next[i].assign(segments.size(), i);
+    }
+    if (config.autostart) start();
+  }
+
+  void start() {
+    running = true;
+    starts.push_back({output.size(), current});
+  }
+
+  uint32_t flip_to(size_t buf_idx, bool low_latency = false) {
+    uint32_t seq = flips.flip_to(buf_idx, [&](size_t from, size_t to) {
+      size_t n = segments.size();
+      for (size_t i = 0; i < n; i++)
+        if (i == n - 1 ||
+            ((low_latency || from == to) && segments[i + 1].flip_point))
+          next[from][i] = to;
+    });
+
+    if (eof_on_demand) {
+      eof_enabled = true;
+      if (eof_raw) isr();
+    }
+    return seq;
+  }
+
+  /// the DMA reached the end of a buffer (or a switch point)
+  void eof() {
+    eof_raw = true;
+    if (eof_enabled) isr();
+  }
+
+  void isr() {
+    eof_raw = false;
+    isr_count++;
+    flips.started(current);
+    if (eof_on_demand && flips.done()) eof_enabled = false;
+  }
+
+  bool flip_done() { return flips.done(); }
+  bool flip_done(uint32_t seq) { return flips.done(seq); }
+
+  // words output on each call to read_position, as the DMA keeps running
+  // while the CPU polls it
+  size_t run_on_read = 0;
+
+  /// the start of the segment being output
+  size_t read_position() {
+    run(run_on_read);
+    return segments[segment].start;
+  }
+
+  // while blanked, blank_word is output instead of the buffers
+  bool blanked = false;
+  dtype blank_word;
+
+  void blank(dtype word, int clkspeed_hz = 0) {
+    blanked = true;
+    blank_word = word;
+  }
+
+  /// resume from the start of the current buffer, as the ESP32 driver does
+  void unblank() {
+    blanked = false;
+    segment = pos = 0;
+    starts.push_back({output.size(), current});
+  }
+
+  size_t segment_end(size_t i) const {
+    return i + 1 < segments.size() ? segments[i + 1].start
+                                   : buffers[current].size();
+  }
+
+  /// run the DMA for len words
+  void run(size_t len) {
+    for (size_t i = 0; running && i < len; i++) {
+      if (blanked) {
+        output.push_back(blank_word);
+        continue;
+      }
+
+      output.push_back(buffers[current][pos++]);
+      if (pos == segment_end(segment)) {
+        size_t to = next[current][segment];
+        segment = (segment + 1) % segments.size();
+        pos = segments[segment].start;
+        if (to != current || segment == 0) {
+          current = to;
+          eof();
+          starts.push_back({output.size(), current});
+        }
+      }
+    }
+  }
+};
+
+/// driver with copy-on-write buffers (see COWBuffers), which records the
+/// output when run like SimDriver, switching buffers only at the end
+template <size_t num_pins, size_t num_buffers>
+struct SimCOWDriver {
+  static_assert(num_buffers == 2, "copy-on-write needs two buffers");
+  using dtype = uint32_t;
+  DMAtrix::COWBuffers<dtype> storage;
+  std::array<DMAtrix::COWView<dtype>, 2> buffers{
+      {{&storage, 0}, {&storage, 1}}};
+
+  using Config = typename SimDriver<num_pins, num_buffers>::Config;
+  static constexpr size_t segment_align = 1;
+  static size_t max_segment_len(const Config &config) {
+    return config.segment_len ? config.segment_len : SIZE_MAX;
+  }
+
+  size_t next[2] = {0, 1};
+  bool running = false;
+  size_t current = 0, pos = 0;
+  DMAtrix::FlipQueue<num_buffers> flips;
+  std::vector<dtype> output;
+
+  void setup(std::array<int, num_pins> data_pins, int clk_pin, Config config,
+             size_t size, const std::vector<DMAtrix::Segment> &segments) {
+    storage.setup(size, segments);
+    running = config.autostart;
+  }
+
+  uint32_t flip_to(size_t buf_idx, bool low_latency = false) {
+    return flips.flip_to(buf_idx,
+                         [&](size_t from, size_t to) { next[from] = to; });
+  }
+
+  bool flip_done() { return flips.done(); }
+  bool flip_done(uint32_t seq) { return flips.done(seq); }
+
+  /// the start of the segment being output
+  size_t read_position() { return storage.starts[storage.segment_of(pos)]; }
+
+  void run(size_t len) {
+    for (size_t i = 0; running && i < len; i++) {
+      output.push_back(storage.read(current, pos++));
+      if (pos == storage.size()) {
+        pos = 0;
+        current = next[current];
+        flips.started(current);
+      }
+    }
+  }
+};
+
+/// stream driver which records the output, rather than sending it anywhere
+template <size_t num_pins>
+struct DummyStreamDriver {
+  using dtype = uint32_t;
+  using Chunk = std::vector<dtype>;
+  using FillFn = void (*)(void *arg, Chunk &chunk, size_t len);
+
+  struct Config {
+    size_t chunk_len = 256;
+  };
+
+  Config config;
+  FillFn fill;
+  void *fill_arg;
+
+  // output which has been generated but not yet captured
+  std::vector<dtype> pending;
+
+  void setup(std::array<int, num_pins> data_pins, int clk_pin, Config config,
+             FillFn fill, void *fill_arg) {
+    this->config = config;
+    this->fill = fill;
+    this->fill_arg = fill_arg;
+  }
+
+  /// run the stream for len words, returning the output
+  std::vector<dtype> capture(size_t len) {
+    Chunk chunk(config.chunk_len);
+    while (pending.size() < len) {
+      fill(fill_arg, chunk, config.chunk_len);
+      pending.insert(pending.end(), chunk.begin(), chunk.end());
+    }
+
+    std::vector<dtype> out(pending.begin(), pending.begin() + len);
+    pending.erase(pending.begin(), pending.begin() + len);
+    return out;
+  }
+};
+
+/// an image with random values of the given bit depth in each channel
+template <typename D>
+Image random_image(size_t bits, unsigned int seed) {
+  srand(seed);
+  Image im((int)D::rows, (int)D::cols, (int)D::colors);
+  for (int row = 0; row < (int)D::rows; row++)
+    for (int col = 0; col < (int)D::cols; col++)
+      for (int color = 0; color < (int)D::colors; color++)
+        im(row, col, color) = rand() & ((1 << bits) - 1);
+  return im;
+}
+
+/// write every pixel of image to driver
+template <typename D, typename Driver>
+void write_image(Driver &driver, const Image &image) {
+  for (int row = 0; row < (int)D::rows; row++)
+    for (int col = 0; col < (int)D::cols; col++)
+      driver.write_rgb(row, col, image(row, col, 0), image(row, col, 1),
+                       image(row, col, 2));
+}
+
+/// check that decoded == multiplier * expected
+inline void check_image(const Image &decoded, const Image &expected,
+                        unsigned int multiplier) {
+  for (int row = 0; row < decoded.dimension(0); row++)
+    for (int col = 0; col < decoded.dimension(1); col++)
+      for (int color = 0; color < decoded.dimension(2); color++)
+        REQUIRE(decoded(row, col, color) ==
+                multiplier * expected(row, col, color));
+}
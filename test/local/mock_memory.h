@@ -0,0 +1,66 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+/// A heap for plan_dma made of separate free blocks of given sizes, to test
+/// behaviour under fragmentation. Allocation is first-fit and 4-aligned, and
+/// the returned pointers can be written.
+struct MockMemory {
+  struct Block {
+    size_t offset, len;
+  };
+
+  std::vector<uint8_t> data;
+  std::vector<Block> free_blocks;
+  // offset and length of each outstanding allocation
+  std::map<void *, Block> allocated;
+
+  explicit MockMemory(const std::vector<size_t> &block_sizes) {
+    // blocks are separated by a gap, so that they can never merge
+    size_t offset = 0;
+    for (size_t len : block_sizes) {
+      free_blocks.push_back({offset, len});
+      offset += (len + 3) / 4 * 4 + 16;
+    }
+    data.resize(offset);
+  }
+
+  void *alloc(size_t bytes) {
+    bytes = (bytes + 3) & ~(size_t)3;
+    for (auto &block : free_blocks)
+      if (block.len >= bytes) {
+        void *res = data.data() + block.offset;
+        allocated[res] = {block.offset, bytes};
+        block.offset += bytes;
+        block.len -= bytes;
+        return res;
+      }
+    return nullptr;
+  }
+
+  void release(void *ptr) {
+    auto it = allocated.find(ptr);
+    assert(it != allocated.end());
+    Block freed = it->second;
+    allocated.erase(it);
+
+    // merge with the block it was taken from
+    for (auto &block : free_blocks)
+      if (block.offset == freed.offset + freed.len) {
+        block.offset = freed.offset;
+        block.len += freed.len;
+        return;
+      }
+    free_blocks.push_back(freed);
+  }
+
+  size_t largest_free() {
+    size_t res = 0;
+    for (auto &block : free_blocks) res = std::max(res, block.len);
+    return res;
+  }
+};
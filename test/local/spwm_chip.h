@@ -0,0 +1,170 @@
+#pragma once
+
+#include <dmatrix/display_model.h>
+#include <dmatrix/spwm_model.h>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "catch.hpp"
+#include "dummy_driver.h"
+
+/// Emulates the chains of S-PWM chips driven by SPWMBufferModel, one chain
+/// per data line, from the words output on the pins. Commands are executed
+/// on the falling edge of LAT, and on each rising edge of GCLK, the time
+/// each output is on is added to the pixel it drives, checking that the
+/// address lines select the row being scanned.
+template <typename D>
+struct SPWMChipChain {
+  using Model = DMAtrix::SPWMBufferModel<D>;
+  static constexpr size_t chips = Model::chips;
+  static constexpr size_t channels = DMAtrix::spwm::channels;
+  static constexpr size_t scan_rows = Model::scan_rows;
+
+  // shift register of each chip on each line
+  std::array<std::array<uint16_t, chips>, D::data_bits> shift_reg{};
+  // config registers, indexed from 1; all chips get the same values, so
+  // they are checked to match
+  std::array<uint32_t, 5> regs{};
+  // bitmask of the registers written, and whether PRE_ACTIVE was just sent
+  uint32_t written = 0;
+  bool active = false;
+
+  // two banks of [line][chip][addr][channel]; the chips display one while
+  // the other is written
+  std::vector<uint16_t> sram[2];
+  size_t display_bank = 0;
+  size_t write_pos = 0;
+  bool vsync_pending = false;
+
+  bool lat = false, gclk = false;
+  size_t lat_len = 0;
+  size_t gclk_count = 0;
+
+  // the on-time of each pixel in the current PWM frame, and in the last
+  // complete one
+  Image counts, last_frame;
+  size_t frames = 0;
+  // GCLKs for which an output was on while the address lines did not
+  // select its row
+  size_t ghosts = 0;
+
+  // the pixel driven by each (line, chip, addr, channel)
+  std::vector<std::array<int, 3>> pixel;
+
+  SPWMChipChain()
+      : counts((int)D::rows, (int)D::cols, (int)D::colors),
+        last_frame((int)D::rows, (int)D::cols, (int)D::colors),
+        pixel(D::data_bits * chips * scan_rows * channels) {
+    for (auto &bank : sram) bank.assign(pixel.size(), 0);
+    counts.setZero();
+    last_frame.setZero();
+
+    for (int row = 0; row < (int)D::rows; row++)
+      for (int col = 0; col < (int)D::cols; col++)
+        for (int color = 0; color < (int)D::colors; color++) {
+          DMAtrix::DataAddr addr = D::encode(row, col, color);
+          pixel[index(addr.bit, addr.word / channels, addr.addr,
+                      addr.word % channels)] = {row, col, color};
+        }
+  }
+
+  static size_t index(size_t line, size_t chip, size_t addr, size_t channel) {
+    return ((line * chips + chip) * scan_rows + addr) * channels + channel;
+  }
+
+  void command(size_t len) {
+    using namespace DMAtrix::spwm;
+
+    if (len == PRE_ACTIVE) {
+      active = true;
+    } else if (len >= write_reg(1) && len <= write_reg(4) && len % 2 == 0) {
+      REQUIRE(active);
+      uint16_t value = shift_reg[0][0];
+      for (auto &line : shift_reg)
+        for (auto v : line) REQUIRE(v == value);
+      regs[(len - 2) / 2] = value;
+      written |= 1 << (len - 2) / 2;
+      active = false;
+    } else if (len == DATA_LATCH) {
+      size_t addr = write_pos / channels % scan_rows;
+      size_t channel = write_pos % channels;
+      for (size_t line = 0; line < D::data_bits; line++)
+        for (size_t chip = 0; chip < chips; chip++)
+          sram[display_bank ^ 1][index(line, chip, addr, channel)] =
+              shift_reg[line][chip];
+      write_pos++;
+    } else if (len == VSYNC) {
+      vsync_pending = true;
+      write_pos = 0;
+    } else {
+      FAIL("unknown command " << len);
+    }
+  }
+
+  void on_gclk(size_t addr_lines) {
+    size_t rows = regs[1] + 1, slot = regs[2] + 1, dead = regs[3],
+           sections = regs[4] + 1;
+    size_t per_slot = dead + slot;
+    // the chips count GCLKs from power-on, but only scan once configured
+    size_t i = gclk_count++ % (per_slot * rows * sections);
+    if (written != 0x1e) return;
+
+    if (i == 0) {
+      if (vsync_pending) display_bank ^= 1;
+      vsync_pending = false;
+      last_frame = counts;
+      counts.setZero();
+      frames++;
+    }
+
+    size_t pos = i % per_slot, row = i / per_slot % rows,
+           section = i / (per_slot * rows);
+    if (pos < dead) return;
+
+    for (size_t line = 0; line < D::data_bits; line++)
+      for (size_t chip = 0; chip < chips; chip++)
+        for (size_t channel = 0; channel < channels; channel++) {
+          size_t idx = index(line, chip, row, channel);
+          size_t value = sram[display_bank][idx];
+          size_t on = value / sections + (section < value % sections);
+          if (pos - dead >= on) continue;
+
+          if (addr_lines != row) ghosts++;
+          auto &p = pixel[idx];
+          counts(p[0], p[1], p[2])++;
+        }
+  }
+
+  /// feed one word, output with one DCLK
+  void feed(uint32_t word) {
+    bool new_lat = (word >> Model::lat_bit()) & 1;
+    bool new_gclk = (word >> Model::gclk_bit()) & 1;
+
+    if (!new_lat && lat_len) {
+      command(lat_len);
+      lat_len = 0;
+    }
+
+    for (size_t line = 0; line < D::data_bits; line++) {
+      auto &chain = shift_reg[line];
+      for (size_t chip = chips - 1; chip > 0; chip--)
+        chain[chip] = (uint16_t)(chain[chip] << 1 | chain[chip - 1] >> 15);
+      chain[0] = (uint16_t)(chain[0] << 1 |
+                            ((word >> Model::data_bit(line)) & 1));
+    }
+    if (new_lat) lat_len++;
+
+    if (new_gclk && !gclk)
+      on_gclk((word >> Model::addr_bit(0)) & (scan_rows - 1));
+
+    lat = new_lat;
+    gclk = new_gclk;
+  }
+
+  template <typename Buffer>
+  void feed_all(const Buffer &words, size_t begin = 0) {
+    for (size_t i = begin; i < words.size(); i++) feed(words[i]);
+  }
+};
@@ -2,93 +2,11 @@
 #include <dmatrix/display_model.h>
 #include <dmatrix/driver.h>
 
-#include <Eigen/Core>
-#include <unsupported/Eigen/CXX11/Tensor>
-
 #include "catch.hpp"
+#include "dummy_driver.h"
 
 using namespace DMAtrix;
 
-using Image = Eigen::Tensor<unsigned int, 3>;
-
-template <size_t num_pins, size_t num_buffers>
-struct DummyDriver {
-  using dtype = uint32_t;
-  std::array<std::vector<dtype>, num_buffers> buffers;
-
-  struct Config {};
-
-  void setup(std::array<int, num_pins> data_pins, int clk_pin, Config config,
-             size_t size) {
-    for (auto &buffer : buffers) buffer.resize(size);
-  }
-
-  /// decode the image in buffer[buf]
-  template <typename D>
-  Image decode(size_t buf) {
-    Image res((int)D::rows, (int)D::cols, (int)D::colors);
-    res.setZero();
-
-    // state of shift register on LE
-    std::vector<unsigned int> shift_reg_front(D::data_words);
-    // circular buffer with for the non-visible shift register
-    std::vector<unsigned int> shift_reg_back(D::data_words);
-    size_t shift_reg_ptr = 0;
-
-    unsigned int oe_clocks = 0;
-    unsigned int oe_addr = 0;
-
-    for (auto &x : buffers[buf]) {
-      bool oe = !(x & 1);
-      bool le = (x >> 1) & 1;
-      unsigned int addr = (x >> 2) & ((1 << D::addr_bits) - 1);
-      unsigned int data = (x >> (2 + D::addr_bits)) & ((1 << D::data_bits) - 1);
-
-      shift_reg_back[shift_reg_ptr] = data;
-
-      if (oe) {
-        REQUIRE(!le);
-
-        // addr is consistent curing oe pulse
-        if (oe_clocks == 0)
-          oe_addr = addr;
-        else
-          REQUIRE(addr == oe_addr);
-
-        oe_clocks++;
-      } else {
-        if (oe_clocks) {
-          // we've finished an oe pulse, with shift_reg_front loaded into the
-          // column drivers (because le was not asserted during the pulse) and
-          // the address lines set to oe_addr
-
-          // where the display was lit during this oe pulse, brighten the result
-          for (size_t row = 0; row < D::rows; row++)
-            for (size_t col = 0; col < D::cols; col++)
-              for (size_t color = 0; color < D::colors; color++) {
-                DataAddr dataaddr = D::encode(row, col, color);
-                if (dataaddr.addr == oe_addr &&
-                    ((shift_reg_front[dataaddr.word] >> dataaddr.bit) & 1))
-                  res((int)row, (int)col, (int)color) += oe_clocks;
-              }
-
-          oe_clocks = 0;
-        }
-      }
-
-      if (le)
-        for (size_t i = 0; i < D::data_words; i++)
-          shift_reg_front[i] =
-              shift_reg_back[(shift_reg_ptr + D::data_words - i) %
-                             D::data_words];
-
-      shift_reg_ptr = (shift_reg_ptr + 1) % D::data_words;
-    }
-
-    return res;
-  }
-};
-
 /// check that if we write image, then that image is displayed correctly.
 /// multiplier is the scaling factor from the written value to the number of
 /// clocks that oe is held low for while that pixel is lit
@@ -131,3 +49,111 @@ TEST_CASE("single_pixels") {
           run_test<D>(driver, im, 2);
         }
 }
+
+TEST_CASE("full_image") {
+  using D = FullDisplay<32, 64, 4>;
+  Pins<D> pins{1, 2, 3, {4, 5, 6, 7}, {8, 9, 10, 11, 12, 13}};
+
+  for (size_t num_bits : {5, 8}) {
+    DisplayDriver<D, DummyDriver, false> driver(pins, 1, num_bits);
+    Image im = random_image<D>(num_bits, num_bits);
+
+    // written as 8 bit values
+    Image scaled = im * (1u << (8 - num_bits));
+    write_image<D>(driver, scaled);
+
+    check_image(driver.pin_driver.decode<D>(0), im, 1);
+  }
+}
+
+TEST_CASE("framebuffered") {
+  using D = FullDisplay<32, 64, 4, RGBOrder::RRGGBB>;
+  Pins<D> pins{1, 2, 3, {4, 5, 6, 7}, {8, 9, 10, 11, 12, 13}};
+  DisplayDriver<D, DummyDriver, true, true> driver(pins, 1, 8);
+
+  Image im = random_image<D>(8, 3);
+  write_image<D>(driver, im);
+  driver.flip();
+  REQUIRE(driver.pin_driver.front_buffer == 1);
+  check_image(driver.pin_driver.decode<D>(1), im, 1);
+
+  // the framebuffer is retained, so partial updates apply to the next frame
+  driver.write_rgb(5, 6, 1, 2, 3);
+  im(5, 6, 0) = 1;
+  im(5, 6, 1) = 2;
+  im(5, 6, 2) = 3;
+  driver.flip();
+  REQUIRE(driver.pin_driver.front_buffer == 0);
+  check_image(driver.pin_driver.decode<D>(0), im, 1);
+}
+
+/// check that primitives write the same buffer as drawing pixel by pixel
+template <typename D, bool framebuffered>
+void test_primitives() {
+  Pins<D> pins{1, 2, 3, {4, 5, 6, 7}, {}};
+  DisplayDriver<D, DummyDriver, false, framebuffered> driver(pins, 1, 7);
+  DisplayDriver<D, DummyDriver, false> reference(pins, 1, 7);
+
+  auto rect = [&](size_t row, size_t col, size_t height, size_t width,
+                  uint8_t r, uint8_t g, uint8_t b) {
+    for (size_t i = 0; i < height; i++)
+      for (size_t j = 0; j < width; j++)
+        reference.write_rgb(row + i, col + j, r, g, b);
+  };
+
+  Image im = random_image<D>(8, 4);
+  write_image<D>(driver, im);
+  write_image<D>(reference, im);
+
+  driver.fill_rect(3, 0, 20, 64, 255, 0, 129);
+  rect(3, 0, 20, 64, 255, 0, 129);
+  driver.hline(31, 10, 13, 1, 2, 3);
+  rect(31, 10, 1, 13, 1, 2, 3);
+  driver.vline(0, 63, 32, 200, 100, 50);
+  rect(0, 63, 32, 1, 200, 100, 50);
+  driver.hline(15, 0, 1, 7, 8, 9);
+  rect(15, 0, 1, 1, 7, 8, 9);
+
+  std::vector<uint8_t> sprite(5 * 7 * 3);
+  for (size_t i = 0; i < sprite.size(); i++) sprite[i] = rand();
+  driver.blit(14, 1, 5, 7, sprite.data());
+  for (size_t i = 0; i < 5; i++)
+    for (size_t j = 0; j < 7; j++) {
+      uint8_t *px = &sprite[(i * 7 + j) * 3];
+      reference.write_rgb(14 + i, 1 + j, px[0], px[1], px[2]);
+    }
+
+  driver.flip();
+  REQUIRE(driver.pin_driver.buffers[0] == reference.pin_driver.buffers[0]);
+}
+
+TEST_CASE("primitives") {
+  test_primitives<FullDisplay<32, 64, 4>, false>();
+  test_primitives<FullDisplay<32, 64, 4>, true>();
+  test_primitives<FullDisplay<32, 64, 4, RGBOrder::RRGGBB>, false>();
+  test_primitives<WrappedDisplay<FullDisplay<32, 64, 4>>, false>();
+  test_primitives<WrappedDisplay<FullDisplay<32, 64, 4>>, true>();
+}
+
+TEST_CASE("copy_forward") {
+  using D = FullDisplay<32, 64, 4>;
+  Pins<D> pins{1, 2, 3, {4, 5, 6, 7}, {8, 9, 10, 11, 12, 13}};
+  DisplayDriver<D, DummyDriver, true> driver(pins, 1, 8);
+  driver.flip_mode = FlipMode::CopyForward;
+
+  Image im = random_image<D>(8, 6);
+  write_image<D>(driver, im);
+  driver.flip();
+  REQUIRE(driver.flip_done());
+  REQUIRE(driver.pin_driver.buffers[0] == driver.pin_driver.buffers[1]);
+
+  // draw over the previous frame
+  driver.write_rgb(31, 63, 1, 2, 3);
+  im(31, 63, 0) = 1;
+  im(31, 63, 1) = 2;
+  im(31, 63, 2) = 3;
+  driver.flip();
+  REQUIRE(driver.flip_done());
+  check_image(driver.pin_driver.decode<D>(0), im, 1);
+  check_image(driver.pin_driver.decode<D>(1), im, 1);
+}
@@ -0,0 +1,145 @@
+#include <dmatrix/animation.h>
+#include <dmatrix/display_model.h>
+#include <dmatrix/driver.h>
+
+#include "catch.hpp"
+#include "dummy_driver.h"
+
+using namespace DMAtrix;
+
+using D = FullDisplay<32, 64, 4>;
+
+/// frame i of a test animation: a random background, with a square moving
+/// across it
+std::vector<uint8_t> animation_frame(size_t i) {
+  srand(1);
+  std::vector<uint8_t> rgb(D::rows * D::cols * D::colors);
+  for (auto &x : rgb) x = rand();
+
+  for (size_t row = 8; row < 16; row++)
+    for (size_t col = 4 * i; col < 4 * i + 8; col++)
+      for (size_t color = 0; color < D::colors; color++)
+        rgb[(row * D::cols + col) * D::colors + color] = 255;
+  return rgb;
+}
+
+/// play an animation compiled for num_buffers buffers through a driver, and
+/// check each frame against encoding it directly
+template <bool double_buffered>
+void check_animation(FlipMode flip_mode, size_t num_buffers,
+                     size_t keyframe_interval) {
+  using Driver = DisplayDriver<D, DummyDriver, double_buffered>;
+  Pins<D> pins{};
+  Driver driver(pins, 1, 8);
+  driver.flip_mode = flip_mode;
+
+  const size_t num_frames = 10;
+  AnimationCompiler<D, uint32_t> compiler(driver.buffer_model, num_buffers,
+                                          keyframe_interval);
+  for (size_t i = 0; i < num_frames; i++)
+    compiler.add_frame(animation_frame(i).data());
+  std::vector<uint8_t> data = compiler.finish();
+
+  Animation<D> animation(data.data(), data.size());
+  REQUIRE(animation.compatible<uint32_t>(driver.buffer_model));
+  REQUIRE(animation.num_frames() == num_frames);
+
+  AnimationPlayer<D, Driver> player(driver, animation);
+  REQUIRE(player.ok);
+  std::vector<uint32_t> expected(driver.buffer_model.buf_len);
+  for (size_t i = 0; i < 3 * num_frames; i++) {
+    REQUIRE(player.next());
+
+    driver.buffer_model.init_buffer(expected);
+    driver.buffer_model.template write_image<uint8_t, 8>(
+        expected, animation_frame(i % num_frames).data());
+    REQUIRE(driver.pin_driver.buffers[driver.pin_driver.front_buffer] ==
+            expected);
+  }
+}
+
+TEST_CASE("animation_playback") {
+  check_animation<true>(FlipMode::Swap, 2, 0);
+  check_animation<true>(FlipMode::Swap, 2, 4);
+  check_animation<true>(FlipMode::CopyForward, 1, 0);
+  check_animation<false>(FlipMode::Swap, 1, 0);
+}
+
+TEST_CASE("animation_format") {
+  BufferModel<D> model(1, 8);
+  AnimationCompiler<D> compiler(model);
+  for (size_t i = 0; i < 4; i++) compiler.add_frame(animation_frame(i).data());
+  std::vector<uint8_t> data = compiler.finish();
+  Animation<D> animation(data.data(), data.size());
+
+  REQUIRE(animation.keyframe(0));
+  REQUIRE(animation.keyframe(1));
+  REQUIRE(!animation.keyframe(2));
+
+  // deltas only contain the moving square
+  size_t keyframe_size = animation.frame_data(1) - animation.frame_data(0);
+  size_t delta_size = animation.frame_data(3) - animation.frame_data(2);
+  REQUIRE(delta_size * 4 < keyframe_size);
+
+  // other configurations are rejected
+  REQUIRE(animation.compatible<uint16_t>(model));
+  REQUIRE(!animation.compatible<uint32_t>(model));
+  REQUIRE(!animation.compatible<uint16_t>(BufferModel<D>(2, 8)));
+  REQUIRE(!animation.compatible<uint16_t>(BufferModel<D>(1, 7)));
+  REQUIRE(!Animation<FullDisplay<32, 32, 4>>(data.data(), data.size())
+               .compatible<uint16_t>(BufferModel<FullDisplay<32, 32, 4>>(1, 8)));
+}
+
+TEST_CASE("animation_rejected") {
+  // compiled for two buffers in Swap mode
+  using Driver = DisplayDriver<D, DummyDriver, true>;
+  Pins<D> pins{};
+  Driver driver(pins, 1, 8);
+  AnimationCompiler<D, uint32_t> compiler(driver.buffer_model);
+  for (size_t i = 0; i < 4; i++) compiler.add_frame(animation_frame(i).data());
+  std::vector<uint8_t> data = compiler.finish();
+  Animation<D> animation(data.data(), data.size());
+  REQUIRE(AnimationPlayer<D, Driver>(driver, animation).ok);
+
+  // the back buffer holds a different frame
+  driver.flip_mode = FlipMode::CopyForward;
+  REQUIRE(!AnimationPlayer<D, Driver>(driver, animation).ok);
+  using SingleDriver = DisplayDriver<D, DummyDriver, false>;
+  SingleDriver single(pins, 1, 8);
+  REQUIRE(!AnimationPlayer<D, SingleDriver>(single, animation).ok);
+
+  // different buffer layout, or no frames
+  Driver other(pins, 2, 8);
+  AnimationPlayer<D, Driver> player(other, animation);
+  REQUIRE(!player.ok);
+  std::vector<uint32_t> before = other.pin_driver.buffers[other.back_buffer];
+  REQUIRE(!player.next());
+  REQUIRE(other.pin_driver.buffers[other.back_buffer] == before);
+
+  // framebuffered drivers overwrite the patches on flip
+  using FramebufferedDriver = DisplayDriver<D, DummyDriver, true, true>;
+  FramebufferedDriver framebuffered(pins, 1, 8);
+  REQUIRE(animation.compatible<uint32_t>(framebuffered.buffer_model));
+  REQUIRE(!AnimationPlayer<D, FramebufferedDriver>(framebuffered, animation)
+               .ok);
+
+  // truncated, or with a patch outside the buffer
+  REQUIRE(!Animation<D>(data.data(), data.size() - 4)
+               .compatible<uint32_t>(driver.buffer_model));
+  REQUIRE(!Animation<D>(data.data(), sizeof(AnimationHeader) + 8)
+               .compatible<uint32_t>(driver.buffer_model));
+  std::vector<uint8_t> corrupt = data;
+  Animation<D> corrupt_animation(corrupt.data(), corrupt.size());
+  auto *patch = (PatchHeader *)(corrupt.data() +
+                                corrupt_animation.frame_offset(2) +
+                                sizeof(FrameHeader));
+  patch->offset = driver.buffer_model.buf_len - patch->count + 1;
+  REQUIRE(!corrupt_animation.compatible<uint32_t>(driver.buffer_model));
+
+  std::vector<uint8_t> empty =
+      AnimationCompiler<D, uint32_t>(driver.buffer_model).finish();
+  driver.flip_mode = FlipMode::Swap;
+  REQUIRE(!AnimationPlayer<D, Driver>(
+               driver, Animation<D>(empty.data(), empty.size()))
+               .ok);
+}
@@ -0,0 +1,74 @@
+#include <dmatrix/composite_driver.h>
+#include <dmatrix/display_model.h>
+
+#include "catch.hpp"
+#include "dummy_driver.h"
+
+using namespace DMAtrix;
+
+using D = FullDisplay<32, 64, 4>;
+using Driver = CompositeDisplayDriver<D, SimDriver, true>;
+
+/// decode the last complete refresh output by pin_driver
+template <typename PinDriver>
+Image last_refresh(const PinDriver &pin_driver) {
+  auto &starts = pin_driver.starts;
+  REQUIRE(starts.size() >= 2);
+  auto begin = pin_driver.output.begin() + starts[starts.size() - 2].first;
+  auto end = pin_driver.output.begin() + starts.back().first;
+  return decode_waveform<D>(std::vector<uint32_t>(begin, end));
+}
+
+TEST_CASE("composite_lockstep") {
+  Pins<D> pins{};
+  Driver driver(pins, pins, 1, 8, {}, {});
+  auto &upper = driver.upper.pin_driver;
+  auto &lower = driver.lower.pin_driver;
+  size_t buf_len = driver.upper.buffer_model.buf_len;
+  REQUIRE(driver.lower.buffer_model.buf_len == buf_len);
+
+  // both started together, after the buffers were initialised
+  REQUIRE(upper.running);
+  REQUIRE(lower.running);
+  REQUIRE(upper.output.empty());
+
+  Image image((int)Driver::rows, (int)Driver::cols, (int)D::colors);
+  for (unsigned int frame = 0; frame < 4; frame++) {
+    srand(frame);
+    std::vector<uint8_t> rgb(Driver::rows * Driver::cols * D::colors);
+    for (size_t i = 0; i < rgb.size(); i++) {
+      rgb[i] = rand();
+      image((int)(i / (D::cols * D::colors)), (int)(i / D::colors % D::cols),
+            (int)(i % D::colors)) = rgb[i];
+    }
+
+    // draw some rows with write_image, and some with blit, which crosses
+    // between the halves
+    driver.write_image(rgb.data());
+    driver.blit(28, 0, 8, D::cols, &rgb[28 * D::cols * D::colors]);
+
+    // flip at an arbitrary point in the refresh
+    upper.run(buf_len / 3 + frame * 101);
+    lower.run(buf_len / 3 + frame * 101);
+    driver.flip();
+    REQUIRE(!driver.flip_done());
+
+    while (!driver.flip_done()) {
+      upper.run(7);
+      lower.run(7);
+    }
+    // run one complete refresh of the new frame
+    upper.run(buf_len);
+    lower.run(buf_len);
+
+    // both switched buffers at the same point in the output
+    REQUIRE(upper.starts == lower.starts);
+
+    Image expected_upper = image.slice(Eigen::array<int, 3>{0, 0, 0},
+                                       Eigen::array<int, 3>{32, 64, 3});
+    Image expected_lower = image.slice(Eigen::array<int, 3>{32, 0, 0},
+                                       Eigen::array<int, 3>{32, 64, 3});
+    check_image(last_refresh(upper), expected_upper, 1);
+    check_image(last_refresh(lower), expected_lower, 1);
+  }
+}
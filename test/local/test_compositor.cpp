@@ -0,0 +1,66 @@
+#include <dmatrix/compositor.h>
+#include <dmatrix/display_model.h>
+#include <dmatrix/driver.h>
+
+#include "catch.hpp"
+#include "dummy_driver.h"
+
+using namespace DMAtrix;
+
+TEST_CASE("compositor") {
+  using D = FullDisplay<32, 64, 4>;
+  Pins<D> pins{1, 2, 3, {4, 5, 6, 7}, {8, 9, 10, 11, 12, 13}};
+  DisplayDriver<D, DummyDriver, false> driver(pins, 1, 8);
+  DisplayDriver<D, DummyDriver, false> reference(pins, 1, 8);
+
+  std::vector<RGBA> sprite(10 * 12);
+  for (auto &px : sprite)
+    px = {(uint8_t)rand(), (uint8_t)rand(), (uint8_t)rand(),
+          (uint8_t)(rand() % 3 == 0 ? 255 : rand())};
+
+  std::vector<uint32_t> bitmap(26 * 7);
+  for (auto &row : bitmap) row = rand() & 0x1f;
+  Font font{'A', 26, 6, 7, bitmap.data()};
+
+  SolidLayer background({10, 20, 30, 255});
+  SpriteLayer sprite_a(sprite.data(), 10, 12);
+  sprite_a.row = -3;
+  sprite_a.col = 58;
+  SpriteLayer sprite_b(sprite.data(), 10, 12);
+  sprite_b.row = 8;
+  sprite_b.col = 4;
+  TextLayer text(font, "ABCDEFGHIJK", {255, 255, 0, 200});
+  text.row = 12;
+  text.col = -2;
+  SolidLayer hidden({255, 255, 255, 255});
+  hidden.visible = false;
+
+  Compositor<D> compositor;
+  compositor.layers = {&hidden, &background, &sprite_a, &sprite_b, &text};
+  compositor.render(driver);
+
+  // draw the same thing pixel by pixel into a full image
+  std::vector<uint8_t> image(D::rows * D::cols * 3);
+  auto px = [&](int row, int col) { return &image[(row * D::cols + col) * 3]; };
+  for (int row = 0; row < (int)D::rows; row++)
+    for (int col = 0; col < (int)D::cols; col++) {
+      blend(px(row, col), background.color);
+      for (auto *s : {&sprite_a, &sprite_b}) {
+        int y = row - s->row, x = col - s->col;
+        if (y >= 0 && y < 10 && x >= 0 && x < 12)
+          blend(px(row, col), sprite[y * 12 + x]);
+      }
+      int y = row - text.row, x = col - text.col;
+      if (y >= 0 && y < 7 && x >= 0 && x < 6 * 11) {
+        uint32_t bits = bitmap[(x / 6) * 7 + y];
+        if ((bits >> (x % 6)) & 1) blend(px(row, col), text.color);
+      }
+    }
+
+  for (int row = 0; row < (int)D::rows; row++)
+    for (int col = 0; col < (int)D::cols; col++)
+      reference.write_rgb(row, col, px(row, col)[0], px(row, col)[1],
+                          px(row, col)[2]);
+
+  REQUIRE(driver.pin_driver.buffers[0] == reference.pin_driver.buffers[0]);
+}
@@ -0,0 +1,103 @@
+#include <dmatrix/cow_buffer.h>
+#include <dmatrix/display_model.h>
+#include <dmatrix/driver.h>
+
+#include "catch.hpp"
+#include "dummy_driver.h"
+
+using namespace DMAtrix;
+
+using D = FullDisplay<32, 64, 4>;
+
+TEST_CASE("cow_buffers") {
+  COWBuffers<uint32_t> storage;
+  storage.setup(100, {{0, true}, {30, true}, {60, true}});
+  COWView<uint32_t> a{&storage, 0}, b{&storage, 1};
+  for (size_t i = 0; i < 100; i++) a[i] = i;
+  REQUIRE(storage.copies == 3);
+  share_buffer(b, a);
+  REQUIRE(storage.copies == 0);
+  REQUIRE(storage.read(1, 50) == 50);
+
+  // the first write to a segment through b copies it
+  b[35] = 1000;
+  b[40] = 1001;
+  REQUIRE(storage.copies == 1);
+  REQUIRE(storage.copy_bytes() == 30 * sizeof(uint32_t));
+  REQUIRE(storage.read(0, 35) == 35);
+  REQUIRE(storage.read(1, 35) == 1000);
+  REQUIRE(storage.read(1, 36) == 36);
+
+  // b's copy is moved back into the base buffer
+  share_buffer(a, b);
+  REQUIRE(storage.copies == 0);
+  REQUIRE(storage.read(0, 35) == 1000);
+  REQUIRE(storage.read(1, 40) == 1001);
+  REQUIRE(storage.retired.size() == 1);
+
+  // b's copy is dropped, and the retired copy is freed
+  b[99] = 5;
+  share_buffer(b, a);
+  REQUIRE(storage.copies == 0);
+  REQUIRE(storage.retired.empty());
+  REQUIRE(storage.read(1, 99) == 99);
+}
+
+TEST_CASE("cow_setup") {
+  // the buffers are initialised in the shared storage, without copies
+  Pins<D> pins{};
+  DisplayDriver<D, SimCOWDriver, true> driver(pins, 1, 8, {true, 128});
+  DisplayDriver<D, DummyDriver, true> reference(pins, 1, 8);
+  auto &storage = driver.pin_driver.storage;
+  REQUIRE(storage.num_segments() > 1);
+  REQUIRE(storage.copies == 0);
+  REQUIRE(storage.retired.empty());
+
+  std::vector<uint32_t> buf(storage.size());
+  for (size_t i = 0; i < buf.size(); i++) buf[i] = storage.read(1, i);
+  REQUIRE(buf == reference.pin_driver.buffers[1]);
+}
+
+TEST_CASE("cow_double_buffer") {
+  Pins<D> pins{};
+  DisplayDriver<D, SimCOWDriver, true> driver(pins, 1, 8, {true, 128});
+  DisplayDriver<D, DummyDriver, true> reference(pins, 1, 8);
+  driver.flip_mode = reference.flip_mode = FlipMode::CopyForward;
+
+  auto &storage = driver.pin_driver.storage;
+  size_t buf_len = driver.buffer_model.buf_len;
+  size_t num_segments = storage.num_segments();
+  REQUIRE(storage.copies == 0);
+
+  Image im = random_image<D>(8, 0);
+  for (size_t frame = 0; frame < 4; frame++) {
+    // a whole frame, then a few small changes
+    if (frame == 0) {
+      write_image<D>(driver, im);
+      write_image<D>(reference, im);
+    } else {
+      for (int col = 0; col < 8; col++) {
+        int row = frame * 3;
+        im(row, col, 0) = im(row, col, 1) = im(row, col, 2) = frame * 10 + col;
+        driver.write_rgb(row, col, frame * 10 + col, frame * 10 + col,
+                         frame * 10 + col);
+        reference.write_rgb(row, col, frame * 10 + col, frame * 10 + col,
+                            frame * 10 + col);
+      }
+      REQUIRE(storage.copies > 0);
+      REQUIRE(storage.copies < num_segments / 4);
+    }
+
+    driver.flip();
+    reference.flip();
+    driver.pin_driver.run(2 * buf_len);
+    REQUIRE(driver.flip_done());
+    REQUIRE(reference.flip_done());
+    REQUIRE(storage.copies == 0);
+
+    std::vector<uint32_t> refresh(driver.pin_driver.output.end() - buf_len,
+                                  driver.pin_driver.output.end());
+    REQUIRE(refresh == reference.pin_driver.buffers[reference.back_buffer ^ 1]);
+    check_image(decode_waveform<D>(refresh), im, 1);
+  }
+}
@@ -0,0 +1,89 @@
+#include <dmatrix/dma_plan.h>
+
+#include <cstring>
+
+#include "catch.hpp"
+#include "mock_memory.h"
+
+using namespace DMAtrix;
+
+namespace {
+  const std::vector<size_t> segment_bytes(10, 1000);
+  const size_t descriptor_bytes = 240;
+
+  // fill every segment with its own value, then check that none were
+  // overwritten, so that no two overlap
+  void check_segments(const DMAPlan &plan) {
+    for (size_t buf = 0; buf < plan.segments.size(); buf++)
+      for (size_t seg = 0; seg < segment_bytes.size(); seg++)
+        memset(plan.segments[buf][seg], (int)(buf * 16 + seg),
+               segment_bytes[seg]);
+    memset(plan.descriptors, 0xff, descriptor_bytes);
+
+    for (size_t buf = 0; buf < plan.segments.size(); buf++)
+      for (size_t seg = 0; seg < segment_bytes.size(); seg++) {
+        auto *data = (uint8_t *)plan.segments[buf][seg];
+        for (size_t i = 0; i < segment_bytes[seg]; i++)
+          REQUIRE(data[i] == buf * 16 + seg);
+      }
+  }
+}
+
+TEST_CASE("dma_plan_arena") {
+  MockMemory mem({30000});
+  DMAPlan plan = plan_dma(mem, 2, segment_bytes, descriptor_bytes);
+  REQUIRE(plan.strategy == DMAPlan::Strategy::Arena);
+  REQUIRE(plan.chunks.size() == 1);
+  REQUIRE(plan.total_bytes() == 20240);
+  REQUIRE(plan.required_bytes == 20240);
+  REQUIRE((uint8_t *)plan.segments[0][0] ==
+          (uint8_t *)plan.descriptors + descriptor_bytes);
+  REQUIRE((uint8_t *)plan.segments[1][0] ==
+          (uint8_t *)plan.segments[0][9] + 1000);
+  check_segments(plan);
+}
+
+TEST_CASE("dma_plan_per_buffer") {
+  MockMemory mem({12000, 12000});
+  DMAPlan plan = plan_dma(mem, 2, segment_bytes, descriptor_bytes);
+  REQUIRE(plan.strategy == DMAPlan::Strategy::PerBuffer);
+  REQUIRE(plan.chunks.size() == 3);
+  REQUIRE(plan.total_bytes() == 20240);
+  check_segments(plan);
+}
+
+TEST_CASE("dma_plan_scattered") {
+  MockMemory mem({6000, 6000, 6000, 4000});
+  DMAPlan plan = plan_dma(mem, 2, segment_bytes, descriptor_bytes);
+  REQUIRE(plan.strategy == DMAPlan::Strategy::Scattered);
+  REQUIRE(plan.total_bytes() == 20240);
+  check_segments(plan);
+
+  // each buffer in as few chunks as the free blocks allow, and segments in
+  // order within each chunk
+  REQUIRE(plan.chunks.size() == 5);
+  for (auto &chunk : plan.chunks) {
+    if (chunk.buffer == SIZE_MAX) continue;
+    auto *pos = (uint8_t *)chunk.data;
+    for (size_t seg = chunk.first_segment; seg <= chunk.last_segment; seg++) {
+      REQUIRE(plan.segments[chunk.buffer][seg] == pos);
+      pos += segment_bytes[seg];
+    }
+    REQUIRE(pos == (uint8_t *)chunk.data + chunk.len);
+  }
+
+  std::string report = plan.report();
+  REQUIRE(report.find("DMA plan: scattered, 20240 of 20240 bytes in 5 "
+                      "chunks") == 0);
+  REQUIRE(report.find("buffer 0 segments 0-5") != std::string::npos);
+  REQUIRE(report.find("buffer 0 segments 6-9") != std::string::npos);
+}
+
+TEST_CASE("dma_plan_failed") {
+  MockMemory mem({8000, 8000});
+  DMAPlan plan = plan_dma(mem, 2, segment_bytes, descriptor_bytes);
+  REQUIRE(!plan.ok());
+  REQUIRE(plan.chunks.empty());
+  REQUIRE(mem.allocated.empty());
+  REQUIRE(plan.report().find("failed") != std::string::npos);
+}
@@ -0,0 +1,200 @@
+#include <dmatrix/display_model.h>
+#include <dmatrix/driver.h>
+#include <dmatrix/flip_queue.h>
+
+#include "catch.hpp"
+#include "dummy_driver.h"
+
+using namespace DMAtrix;
+
+TEST_CASE("flip_queue_eof_race") {
+  FlipQueue<2> flips;
+  size_t next[2] = {0, 1};
+
+  // the end of buffer 0 is reached just before it is relinked, so buffer 0
+  // repeats, and the flip must not be reported as done
+  uint32_t seq = flips.flip_to(1, [&](size_t from, size_t to) {
+    if (from == 0) flips.started(next[0]);
+    next[from] = to;
+  });
+  REQUIRE(!flips.done(seq));
+  REQUIRE(flips.front == 0);
+
+  flips.started(next[0]);
+  REQUIRE(flips.done(seq));
+  REQUIRE(flips.front == 1);
+
+  // the end of buffer 1 is reached just after it is relinked
+  seq = flips.flip_to(0, [&](size_t from, size_t to) {
+    next[from] = to;
+    if (from == 1) flips.started(next[1]);
+  });
+  REQUIRE(flips.done(seq));
+  REQUIRE(flips.front == 0);
+}
+
+TEST_CASE("flip_pipelined") {
+  SimDriver<8, 3> driver;
+  driver.setup({}, 0, {}, 100, {{0, true}});
+
+  driver.run(50);
+  uint32_t seq1 = driver.flip_to(1);
+  uint32_t seq2 = driver.flip_to(2);
+  REQUIRE(!driver.flip_done(seq1));
+
+  driver.run(50);
+  REQUIRE(driver.flip_done(seq1));
+  REQUIRE(!driver.flip_done(seq2));
+  REQUIRE(!driver.flip_done());
+
+  // buffer 1 is shown for exactly one refresh
+  driver.run(100);
+  REQUIRE(driver.flip_done(seq2));
+  REQUIRE(driver.flip_done());
+
+  driver.run(200);
+  using Start = std::pair<size_t, size_t>;
+  REQUIRE(driver.starts == std::vector<Start>{{0, 0},
+                                              {100, 1},
+                                              {200, 2},
+                                              {300, 2},
+                                              {400, 2}});
+}
+
+TEST_CASE("flip_seq") {
+  using D = FullDisplay<32, 64, 4>;
+  Pins<D> pins{};
+  DisplayDriver<D, SimDriver, true> driver(pins, 1, 8);
+  auto &pin_driver = driver.pin_driver;
+  size_t buf_len = driver.buffer_model.buf_len;
+
+  for (size_t frame = 0; frame < 4; frame++) {
+    // flip just before, at, and just after the end of a buffer
+    pin_driver.run(buf_len - 1 + (frame % 3));
+    uint32_t seq = driver.flip();
+    REQUIRE(!driver.flip_done(seq));
+
+    size_t words = 0;
+    while (!driver.flip_done(seq)) {
+      pin_driver.run(1);
+      words++;
+    }
+    REQUIRE(pin_driver.current == (driver.back_buffer ^ 1));
+    REQUIRE(pin_driver.pos == 0);
+    REQUIRE(words <= buf_len);
+  }
+}
+
+TEST_CASE("flip_twice") {
+  // a second flip before the first is done targets the front buffer, and
+  // cancels the first
+  using D = FullDisplay<32, 64, 4>;
+  Pins<D> pins{};
+  DisplayDriver<D, SimDriver, true> driver(pins, 1, 8);
+  auto &pin_driver = driver.pin_driver;
+  size_t buf_len = driver.buffer_model.buf_len;
+
+  pin_driver.run(buf_len / 2);
+  uint32_t seq1 = driver.flip();
+  uint32_t seq2 = driver.flip();
+  REQUIRE(!driver.flip_done(seq1));
+
+  pin_driver.run(buf_len);
+  REQUIRE(driver.flip_done(seq1));
+  REQUIRE(driver.flip_done(seq2));
+  REQUIRE(driver.flip_done());
+  REQUIRE(pin_driver.current == 0);
+
+  // flips work as normal afterwards
+  uint32_t seq3 = driver.flip();
+  pin_driver.run(buf_len);
+  REQUIRE(driver.flip_done(seq3));
+  REQUIRE(pin_driver.current == 1);
+
+  // with more buffers, flipping back to a queued buffer cancels the flips
+  // queued after it
+  SimDriver<8, 3> three;
+  three.setup({}, 0, {}, 100, {{0, true}});
+  three.run(50);
+  uint32_t a = three.flip_to(1);
+  uint32_t b = three.flip_to(2);
+  uint32_t c = three.flip_to(1);
+  three.run(100);
+  REQUIRE(three.flip_done(a));
+  REQUIRE(three.flip_done(b));
+  REQUIRE(three.flip_done(c));
+  three.run(200);
+  REQUIRE(three.current == 1);
+}
+
+TEST_CASE("blank") {
+  using D = FullDisplay<32, 64, 4>;
+  Pins<D> pins{};
+  DisplayDriver<D, SimDriver, true> driver(pins, 1, 8);
+  auto &pin_driver = driver.pin_driver;
+  size_t buf_len = driver.buffer_model.buf_len;
+
+  Image image = random_image<D>(8, 0);
+  write_image<D>(driver, image);
+  driver.flip();
+  pin_driver.run(buf_len + 100);
+
+  // everything off, with OE high
+  driver.blank();
+  size_t start = pin_driver.output.size();
+  pin_driver.run(1000);
+  for (size_t i = start; i < pin_driver.output.size(); i++)
+    REQUIRE(pin_driver.output[i] == 1);
+
+  // flips wait for unblank
+  write_image<D>(driver, random_image<D>(8, 1));
+  uint32_t seq = driver.flip();
+  pin_driver.run(2 * buf_len);
+  REQUIRE(!driver.flip_done(seq));
+
+  // the front buffer is shown again from the start, without being redrawn
+  driver.unblank();
+  start = pin_driver.output.size();
+  pin_driver.run(buf_len);
+  std::vector<uint32_t> refresh(pin_driver.output.begin() + start,
+                                pin_driver.output.end());
+  REQUIRE(refresh == pin_driver.buffers[1]);
+  REQUIRE(driver.flip_done(seq));
+  REQUIRE(pin_driver.current == 0);
+}
+
+TEST_CASE("eof_on_demand") {
+  using D = FullDisplay<32, 64, 4>;
+  Pins<D> pins{};
+  size_t isr_counts[2];
+
+  for (bool on_demand : {false, true}) {
+    DisplayDriver<D, SimDriver, true> driver(pins, 1, 8,
+                                             {true, 0, on_demand});
+    auto &pin_driver = driver.pin_driver;
+    size_t buf_len = driver.buffer_model.buf_len;
+
+    // idle, then flip just before, at, and just after the end of a buffer,
+    // then idle again
+    pin_driver.run(10 * buf_len);
+    for (size_t frame = 0; frame < 3; frame++) {
+      pin_driver.run(buf_len - 1 + frame - pin_driver.pos);
+      uint32_t seq = driver.flip();
+
+      size_t words = 0;
+      while (!driver.flip_done(seq)) {
+        pin_driver.run(1);
+        words++;
+      }
+      REQUIRE(pin_driver.current == (driver.back_buffer ^ 1));
+      REQUIRE(pin_driver.pos == 0);
+      REQUIRE(words <= buf_len);
+    }
+    pin_driver.run(10 * buf_len);
+    isr_counts[on_demand] = pin_driver.isr_count;
+  }
+
+  // one interrupt per refresh, or per flip
+  REQUIRE(isr_counts[0] > 20);
+  REQUIRE(isr_counts[1] <= 6);
+}
@@ -0,0 +1,52 @@
+#include <dmatrix/display_model.h>
+#include <dmatrix/driver.h>
+#include <dmatrix/gamma.h>
+
+#include "catch.hpp"
+#include "dummy_driver.h"
+
+using namespace DMAtrix;
+
+using D = FullDisplay<32, 64, 4>;
+
+TEST_CASE("gamma_codes") {
+  std::vector<size_t> weights{1, 2, 4, 8, 16, 32, 63, 101, 205, 237};
+  size_t total = code_brightness(weights, (1 << weights.size()) - 1);
+
+  std::vector<uint16_t> codes = gamma_codes(weights);
+  REQUIRE(codes.size() == 256);
+  REQUIRE(code_brightness(weights, codes[0]) == 0);
+  REQUIRE(code_brightness(weights, codes[255]) == total);
+  for (size_t v = 1; v < 256; v++)
+    REQUIRE(code_brightness(weights, codes[v]) >=
+            code_brightness(weights, codes[v - 1]));
+
+  // between 9 and 10 binary bitplanes, in both buffer length and the number
+  // of levels shown
+  std::vector<size_t> binary_9 = BufferModel<D>::binary_weights(1, 9);
+  std::vector<size_t> binary_10 = BufferModel<D>::binary_weights(1, 10);
+  REQUIRE(distinct_levels(weights, codes) >
+          distinct_levels(binary_9, gamma_codes(binary_9)));
+  REQUIRE(BufferModel<D>(weights).buf_len <
+          BufferModel<D>(binary_10).buf_len);
+}
+
+TEST_CASE("weighted_bitplanes") {
+  Pins<D> pins{};
+  std::vector<size_t> weights{1, 2, 4, 8, 16, 32, 63, 101, 205, 237};
+  DisplayDriver<D, DummyDriver, false> driver(pins, weights);
+
+  Image codes = random_image<D>(10, 0);
+  for (int row = 0; row < (int)D::rows; row++)
+    for (int col = 0; col < (int)D::cols; col++)
+      driver.write_rgb<uint16_t, 10>(row, col, codes(row, col, 0),
+                                     codes(row, col, 1), codes(row, col, 2));
+
+  Image expected = codes;
+  for (int row = 0; row < (int)D::rows; row++)
+    for (int col = 0; col < (int)D::cols; col++)
+      for (int color = 0; color < (int)D::colors; color++)
+        expected(row, col, color) =
+            code_brightness(weights, codes(row, col, color));
+  check_image(driver.pin_driver.decode<D>(0), expected, 1);
+}
@@ -0,0 +1,247 @@
+#include <dmatrix/display_model.h>
+#include <dmatrix/driver.h>
+#include <dmatrix/ingest.h>
+#include <dmatrix/udp_source.h>
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <deque>
+
+#include "catch.hpp"
+#include "dummy_driver.h"
+
+using namespace DMAtrix;
+
+using D = FullDisplay<32, 64, 4>;
+using Driver = DisplayDriver<D, DummyDriver, true>;
+
+/// datagram source which reads from a queue, standing in for a socket
+struct QueueSource {
+  std::deque<std::vector<uint8_t>> datagrams;
+
+  void push(const uint8_t *buf, size_t len) {
+    datagrams.emplace_back(buf, buf + len);
+  }
+
+  size_t receive(uint8_t *buf, size_t len) {
+    if (datagrams.empty()) return 0;
+    auto &datagram = datagrams.front();
+    size_t n = std::min(len, datagram.size());
+    std::copy(datagram.begin(), datagram.begin() + n, buf);
+    datagrams.pop_front();
+    return n;
+  }
+};
+
+/// image as interleaved 8 bit rgb
+std::vector<uint8_t> image_rgb(const Image &image) {
+  std::vector<uint8_t> rgb;
+  for (int row = 0; row < (int)D::rows; row++)
+    for (int col = 0; col < (int)D::cols; col++)
+      for (int color = 0; color < (int)D::colors; color++)
+        rgb.push_back(image(row, col, color));
+  return rgb;
+}
+
+/// send image as universes of 170 pixels starting at universe 1, using
+/// make_packet(buf, universe, data, len), to send(buf, len)
+template <typename MakePacket, typename Send>
+void send_image(const Image &image, MakePacket make_packet, Send send) {
+  std::vector<uint8_t> rgb = image_rgb(image);
+  uint8_t buf[1500];
+  for (size_t start = 0, universe = 1; start < rgb.size();
+       start += 510, universe++) {
+    size_t len = std::min<size_t>(510, rgb.size() - start);
+    send(buf, make_packet(buf, universe, rgb.data() + start, len));
+  }
+}
+
+TEST_CASE("parse_packets") {
+  uint8_t data[6] = {1, 2, 3, 4, 5, 6};
+  uint8_t buf[200];
+
+  Packet packet = parse_packet(buf, make_artnet_dmx(buf, 300, data, 6));
+  REQUIRE(packet.type == Packet::Type::Data);
+  REQUIRE(packet.universe == 300);
+  REQUIRE(packet.len == 6);
+  REQUIRE(std::equal(data, data + 6, packet.data));
+
+  packet = parse_packet(buf, make_artnet_sync(buf));
+  REQUIRE(packet.type == Packet::Type::Sync);
+
+  packet = parse_packet(buf, make_e131_data(buf, 7, data, 6, 1000));
+  REQUIRE(packet.type == Packet::Type::Data);
+  REQUIRE(packet.universe == 7);
+  REQUIRE(packet.len == 6);
+  REQUIRE(std::equal(data, data + 6, packet.data));
+
+  packet = parse_packet(buf, make_e131_sync(buf, 1000));
+  REQUIRE(packet.type == Packet::Type::Sync);
+  REQUIRE(packet.universe == 1000);
+
+  // truncated packets are rejected or clipped
+  REQUIRE(parse_packet(buf, 10).type == Packet::Type::Invalid);
+  packet = parse_packet(buf, make_artnet_dmx(buf, 1, data, 6) - 2);
+  REQUIRE(packet.len == 4);
+  size_t len = make_e131_data(buf, 7, data, 6);
+  buf[125] = 0xdd;  // non-null start code
+  REQUIRE(parse_packet(buf, len).type == Packet::Type::Invalid);
+}
+
+TEST_CASE("ingest_sync") {
+  Pins<D> pins{};
+  Driver driver(pins, 1, 8);
+  Ingest<D, Driver> ingest(driver);
+  QueueSource source;
+  auto send = [&](const uint8_t *buf, size_t len) { source.push(buf, len); };
+  uint8_t buf[200], data[3] = {};
+
+  for (unsigned int frame = 0; frame < 3; frame++) {
+    Image image = random_image<D>(8, frame);
+    send_image(image,
+               [](uint8_t *buf, uint16_t universe, const uint8_t *data,
+                  size_t len) {
+                 return make_e131_data(buf, universe, data, len, 1000);
+               },
+               send);
+    // universe not on the display
+    send(buf, make_e131_data(buf, 20, data, 3, 1000));
+
+    ingest.poll(source);
+    REQUIRE(ingest.stats.frames == frame);
+
+    send(buf, make_e131_sync(buf, 1000));
+    ingest.poll(source);
+    REQUIRE(ingest.stats.frames == frame + 1);
+
+    check_image(driver.pin_driver.decode<D>(driver.pin_driver.front_buffer),
+                image, 1);
+  }
+  REQUIRE(ingest.stats.ignored == 3);
+}
+
+TEST_CASE("ingest_unsynced") {
+  // without sync packets, flip after the last universe
+  Pins<D> pins{};
+  Driver driver(pins, 1, 8);
+  Ingest<D, Driver> ingest(driver);
+  QueueSource source;
+
+  Image image = random_image<D>(8, 5);
+  send_image(image,
+             [](uint8_t *buf, uint16_t universe, const uint8_t *data,
+                size_t len) {
+               return make_artnet_dmx(buf, universe, data, len);
+             },
+             [&](const uint8_t *buf, size_t len) { source.push(buf, len); });
+  ingest.poll(source);
+
+  REQUIRE(ingest.stats.frames == 1);
+  check_image(driver.pin_driver.decode<D>(driver.pin_driver.front_buffer),
+              image, 1);
+}
+
+TEST_CASE("ingest_udp") {
+  Pins<D> pins{};
+  Driver driver(pins, 1, 8);
+  Ingest<D, Driver> ingest(driver);
+
+  UDPSource source;
+  REQUIRE(source.open(0));
+
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(source.port());
+  auto send = [&](const uint8_t *buf, size_t len) {
+    sendto(fd, buf, len, 0, (sockaddr *)&addr, sizeof(addr));
+  };
+
+  Image image = random_image<D>(8, 7);
+  send_image(image,
+             [](uint8_t *buf, uint16_t universe, const uint8_t *data,
+                size_t len) {
+               return make_artnet_dmx(buf, universe, data, len);
+             },
+             send);
+  uint8_t buf[20];
+  send(buf, make_artnet_sync(buf));
+
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (ingest.stats.frames == 0 &&
+         std::chrono::steady_clock::now() < deadline)
+    ingest.poll(source);
+  close(fd);
+
+  REQUIRE(ingest.stats.frames == 1);
+  check_image(driver.pin_driver.decode<D>(driver.pin_driver.front_buffer),
+              image, 1);
+}
+
+TEST_CASE("udp_source_move") {
+  UDPSource a;
+  REQUIRE(a.open(0));
+  int fd = a.fd;
+
+  UDPSource b(std::move(a));
+  REQUIRE(a.fd == -1);
+  REQUIRE(b.fd == fd);
+
+  UDPSource c;
+  REQUIRE(c.open(0));
+  c = std::move(b);
+  REQUIRE(b.fd == -1);
+  REQUIRE(c.fd == fd);
+  REQUIRE(c.port() != 0);
+}
+
+TEST_CASE("ingest_sync_universe") {
+  // E1.31 sync packets only present data which names their sync universe
+  Pins<D> pins{};
+  Driver driver(pins, 1, 8);
+  Ingest<D, Driver> ingest(driver);
+  uint8_t buf[200], data[3] = {1, 2, 3};
+
+  ingest.handle(buf, make_e131_data(buf, 1, data, 3, 1000));
+  ingest.handle(buf, make_e131_sync(buf, 2000));
+  REQUIRE(ingest.stats.frames == 0);
+  ingest.handle(buf, make_e131_sync(buf, 1000));
+  REQUIRE(ingest.stats.frames == 1);
+
+  // nothing new for the display
+  ingest.handle(buf, make_e131_sync(buf, 1000));
+  ingest.handle(buf, make_artnet_sync(buf));
+  REQUIRE(ingest.stats.frames == 1);
+
+  // ArtSync presents everything; decoding notices that the last flip has
+  // completed, whether or not asserts are enabled
+  REQUIRE(ingest.flipping);
+  ingest.handle(buf, make_e131_data(buf, 1, data, 3, 1000));
+  REQUIRE(!ingest.flipping);
+  ingest.handle(buf, make_artnet_sync(buf));
+  REQUIRE(ingest.stats.frames == 2);
+}
+
+TEST_CASE("ingest_flip_pending") {
+  // datagrams after a flip stay in the source until it completes
+  using SimDriverT = DisplayDriver<D, SimDriver, true>;
+  Pins<D> pins{};
+  SimDriverT driver(pins, 1, 8);
+  Ingest<D, SimDriverT> ingest(driver);
+  QueueSource source;
+  uint8_t buf[200], data[3] = {1, 2, 3};
+
+  source.push(buf, make_e131_data(buf, 1, data, 3, 1000));
+  source.push(buf, make_e131_sync(buf, 1000));
+  source.push(buf, make_e131_data(buf, 1, data, 3, 1000));
+  REQUIRE(ingest.poll(source) == 2);
+  REQUIRE(ingest.flip_pending());
+  REQUIRE(source.datagrams.size() == 1);
+  REQUIRE(ingest.poll(source) == 0);
+  REQUIRE(ingest.stats.flip_waits == 2);
+
+  driver.pin_driver.run(driver.buffer_model.buf_len);
+  REQUIRE(ingest.poll(source) == 1);
+  REQUIRE(source.datagrams.empty());
+}
@@ -0,0 +1,72 @@
+#include <dmatrix/loop_chain.h>
+
+#include "catch.hpp"
+
+using namespace DMAtrix;
+
+namespace {
+  // the parts of lldesc_t used by LoopChain
+  struct MockDesc {
+    const int *buf;
+    unsigned eof;
+    struct {
+      MockDesc *stqe_next;
+    } qe;
+  };
+
+  // a frame of data split over count descriptors, looping like DMABuffer
+  struct MockFrame {
+    std::vector<int> data;
+    std::vector<MockDesc> descs;
+
+    MockFrame(int frame, size_t count) : data(count, frame), descs(count) {
+      for (size_t i = 0; i < count; i++)
+        descs[i] = {&data[i], i == count - 1, {&descs[(i + 1) % count]}};
+    }
+  };
+}
+
+TEST_CASE("loop_chain") {
+  std::vector<MockFrame> frames;
+  for (int i = 0; i < 3; i++) frames.emplace_back(i, 4 + i);
+  std::vector<MockDesc *> descs;
+  std::vector<size_t> counts;
+  for (auto &frame : frames) {
+    descs.push_back(frame.descs.data());
+    counts.push_back(frame.descs.size());
+  }
+  std::vector<size_t> holds{2, 1, 3};
+
+  LoopChain<MockDesc> loop;
+  loop.build(descs.data(), counts.data(), holds);
+
+  // follow the chain as the DMA would, through two loops, reading the
+  // frame from the data
+  MockDesc *desc = descs[0];
+  for (int pass = 0; pass < 2; pass++)
+    for (int frame = 0; frame < 3; frame++)
+      for (size_t hold = 0; hold < holds[frame]; hold++)
+        for (size_t i = 0; i < counts[frame]; i++) {
+          REQUIRE(*desc->buf == frame);
+          REQUIRE(desc->buf == &frames[frame].data[i]);
+          REQUIRE(desc->eof == 0);
+          REQUIRE(loop.frame_of(desc) == (size_t)frame);
+          desc = desc->qe.stqe_next;
+        }
+  REQUIRE(desc == descs[0]);
+
+  MockDesc other;
+  REQUIRE(loop.frame_of(&other) == 3);
+
+  // each frame loops on itself again, with eof at its end
+  loop.restore();
+  REQUIRE(!loop.active());
+  for (size_t frame = 0; frame < 3; frame++) {
+    desc = descs[frame];
+    for (size_t i = 0; i < counts[frame]; i++) {
+      REQUIRE(desc->eof == (i == counts[frame] - 1));
+      desc = desc->qe.stqe_next;
+    }
+    REQUIRE(desc == descs[frame]);
+  }
+}
@@ -0,0 +1,131 @@
+#include <dmatrix/display_model.h>
+#include <dmatrix/driver.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include "catch.hpp"
+#include "dummy_driver.h"
+
+using namespace DMAtrix;
+
+using D = FullDisplay<32, 64, 4>;
+
+TEST_CASE("segments") {
+  BufferModel<D> model(1, 8);
+
+  for (size_t align : {1, 4})
+    for (size_t max_len : {16, 64, 100, 1000}) {
+      auto segments = model.segments(max_len, align);
+      REQUIRE(segments[0].start == 0);
+
+      for (size_t i = 0; i < segments.size(); i++) {
+        size_t end =
+            i + 1 < segments.size() ? segments[i + 1].start : model.buf_len;
+        REQUIRE(end > segments[i].start);
+        REQUIRE(end - segments[i].start <= max_len);
+        REQUIRE(segments[i].start % align == 0);
+
+        // flip points don't split the data region of any subframe
+        if (segments[i].flip_point)
+          for (auto &frame : model.subframes) {
+            size_t offset = (segments[i].start + model.buf_len -
+                             frame.data_offset - 1) %
+                            model.buf_len;
+            REQUIRE((offset == 0 || offset >= D::data_words));
+          }
+
+        // data regions are 64 words, so there is an unaligned flip point in
+        // any segment longer than that; the buffer starts one word before
+        // the end of the data for the last subframe
+        if (align == 1 && max_len >= 100 && i > 0)
+          REQUIRE(segments[i].flip_point);
+      }
+    }
+}
+
+/// Flip to a new random image at random times, returning the number of words
+/// output between each flip and its completion. The refresh after each flip
+/// must show exactly the new frame, and the refresh in which the switch
+/// happens must show each subframe entirely from either the old or new frame.
+template <typename Driver>
+std::vector<size_t> flip_latencies(Driver &driver, size_t count) {
+  auto &pin_driver = driver.pin_driver;
+  size_t buf_len = driver.buffer_model.buf_len;
+  std::vector<size_t> latencies;
+
+  for (size_t i = 0; i < count; i++) {
+    pin_driver.run(rand() % buf_len);
+
+    std::vector<uint32_t> old_buf = pin_driver.buffers[driver.back_buffer ^ 1];
+    write_image<D>(driver, random_image<D>(8, i));
+    std::vector<uint32_t> new_buf = pin_driver.buffers[driver.back_buffer];
+
+    size_t start = pin_driver.output.size();
+    uint32_t seq = driver.flip();
+    while (!driver.flip_done(seq)) pin_driver.run(1);
+    latencies.push_back(pin_driver.output.size() - start);
+
+    size_t end = pin_driver.output.size() + buf_len;
+    pin_driver.run(buf_len);
+
+    // check the transition, by comparing each subframe data region (and the
+    // rest of the buffer) output since the flip with each frame
+    for (size_t o = start; o < end;) {
+      size_t len = 1;
+      for (auto &frame : driver.buffer_model.subframes)
+        if (o % buf_len == (frame.data_offset + 1) % buf_len)
+          len = D::data_words;
+      len = std::min(len, end - o);
+
+      // the end of the buffer is not a flip point, so the subframe which
+      // spans it is mixed by regular flips
+      if (o % buf_len + len > buf_len) {
+        o += len;
+        continue;
+      }
+
+      bool is_old = true, is_new = true;
+      for (size_t j = o; j < o + len; j++) {
+        is_old &= pin_driver.output[j] == old_buf[j % buf_len];
+        is_new &= pin_driver.output[j] == new_buf[j % buf_len];
+      }
+      REQUIRE((is_old || is_new));
+      if (o >= end - buf_len) REQUIRE(is_new);
+      o += len;
+    }
+  }
+  return latencies;
+}
+
+TEST_CASE("flip_low_latency") {
+  Pins<D> pins{};
+  srand(1);
+
+  // flip at the end of the buffer
+  DisplayDriver<D, SimDriver, true> normal(pins, 1, 8, {true, 128});
+  auto normal_latencies = flip_latencies(normal, 50);
+
+  // flip at the next flip point
+  DisplayDriver<D, SimDriver, true> low(pins, 1, 8, {true, 128});
+  low.low_latency_flip = true;
+  auto low_latencies = flip_latencies(low, 50);
+
+  size_t buf_len = normal.buffer_model.buf_len;
+  size_t normal_max = *std::max_element(normal_latencies.begin(),
+                                        normal_latencies.end());
+  size_t low_max =
+      *std::max_element(low_latencies.begin(), low_latencies.end());
+  REQUIRE(normal_max <= buf_len);
+  REQUIRE(normal_max > buf_len / 2);
+  REQUIRE(low_max <= 128);
+
+  // flips are at random times, so the mean latency is half a refresh, or
+  // about half a segment
+  auto mean = [](const std::vector<size_t> &latencies) {
+    size_t total = 0;
+    for (size_t latency : latencies) total += latency;
+    return total / latencies.size();
+  };
+  REQUIRE(mean(normal_latencies) > buf_len / 4);
+  REQUIRE(mean(low_latencies) < 128);
+}
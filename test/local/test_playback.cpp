@@ -0,0 +1,110 @@
+#include <dmatrix/animation.h>
+#include <dmatrix/display_model.h>
+#include <dmatrix/driver.h>
+#include <dmatrix/mapped_file.h>
+#include <dmatrix/playback.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "catch.hpp"
+#include "dummy_driver.h"
+
+using namespace DMAtrix;
+
+using D = FullDisplay<32, 64, 4>;
+using Driver = DisplayDriver<D, DummyDriver, true>;
+
+/// write data to a new temporary file, returning its name
+static std::string write_temp(const std::vector<uint8_t> &data) {
+  char name[] = "/tmp/dmatrix_playbackXXXXXX";
+  int fd = mkstemp(name);
+  REQUIRE(fd >= 0);
+  REQUIRE(write(fd, data.data(), data.size()) == (ssize_t)data.size());
+  close(fd);
+  return name;
+}
+
+/// play 2.5 loops of num_frames frames from source, checking each against
+/// encoding frames directly
+template <typename Source>
+static void check_playback(Driver &driver, Source &source,
+                           const std::vector<uint8_t> &frames,
+                           size_t num_frames) {
+  REQUIRE(source.num_frames() == num_frames);
+  size_t frame_bytes = frames.size() / num_frames;
+
+  std::vector<uint32_t> expected(driver.buffer_model.buf_len);
+  for (size_t i = 0; i < 5 * num_frames / 2; i++) {
+    REQUIRE(play_frame(driver, source));
+
+    driver.buffer_model.init_buffer(expected);
+    driver.buffer_model.write_image<uint8_t, 8>(
+        expected, &frames[(i % num_frames) * frame_bytes]);
+    REQUIRE(driver.pin_driver.buffers[driver.pin_driver.front_buffer] ==
+            expected);
+  }
+}
+
+TEST_CASE("mapped_playback") {
+  Pins<D> pins{};
+  Driver driver(pins, 1, 8);
+
+  const size_t num_frames = 6;
+  const size_t frame_bytes = D::rows * D::cols * D::colors;
+  std::vector<uint8_t> frames(num_frames * frame_bytes);
+  srand(3);
+  for (auto &x : frames) x = rand();
+
+  SECTION("raw") {
+    std::string name = write_temp(frames);
+    MappedFile file;
+    REQUIRE(file.open(name.c_str()));
+    RawSource<D, MappedFile> source(file);
+    REQUIRE(source.ok);
+    check_playback(driver, source, frames, num_frames);
+    remove(name.c_str());
+  }
+
+  SECTION("animation") {
+    AnimationCompiler<D, uint32_t> compiler(driver.buffer_model);
+    for (size_t i = 0; i < num_frames; i++)
+      compiler.add_frame(&frames[i * frame_bytes]);
+    std::string name = write_temp(compiler.finish());
+
+    MappedFile file;
+    REQUIRE(file.open(name.c_str()));
+    AnimationSource<D, MappedFile> source(file, driver);
+    REQUIRE(source.ok);
+    check_playback(driver, source, frames, num_frames);
+    remove(name.c_str());
+  }
+
+  SECTION("rejected") {
+    // too short for a frame, or for the animation it claims to be
+    MemoryMapping short_raw{frames.data(), frame_bytes - 1};
+    RawSource<D, MemoryMapping> raw(short_raw);
+    REQUIRE(!raw.ok);
+    REQUIRE(!play_frame(driver, raw));
+
+    AnimationCompiler<D, uint32_t> compiler(driver.buffer_model);
+    for (size_t i = 0; i < num_frames; i++)
+      compiler.add_frame(&frames[i * frame_bytes]);
+    std::vector<uint8_t> data = compiler.finish();
+    for (size_t len : {(size_t)0, sizeof(AnimationHeader), data.size() - 4}) {
+      MemoryMapping truncated{data.data(), len};
+      AnimationSource<D, MemoryMapping> source(truncated, driver);
+      REQUIRE(!source.ok);
+      REQUIRE(source.num_frames() == 0);
+      REQUIRE(!play_frame(driver, source));
+    }
+
+    std::vector<uint8_t> empty =
+        AnimationCompiler<D, uint32_t>(driver.buffer_model).finish();
+    MemoryMapping no_frames{empty.data(), empty.size()};
+    REQUIRE(!AnimationSource<D, MemoryMapping>(no_frames, driver).ok);
+  }
+
+  MappedFile missing;
+  REQUIRE(!missing.open("/nonexistent/file"));
+}
@@ -0,0 +1,102 @@
+#include <dmatrix/display_model.h>
+#include <dmatrix/driver.h>
+
+#include <cstdlib>
+#include "catch.hpp"
+#include "dummy_driver.h"
+
+using namespace DMAtrix;
+
+using D = FullDisplay<32, 64, 4>;
+
+TEST_CASE("race_beam") {
+  Pins<D> pins{};
+  DisplayDriver<D, SimDriver, false, true> driver(pins, 1, 8, {true, 64});
+  driver.race_beam = true;
+  auto &pin_driver = driver.pin_driver;
+  auto &model = driver.buffer_model;
+  size_t buf_len = model.buf_len;
+  srand(1);
+
+  for (size_t i = 0; i < 20; i++) {
+    pin_driver.run(rand() % buf_len);
+
+    std::vector<uint32_t> old_buf = pin_driver.buffers[0];
+    write_image<D>(driver, random_image<D>(8, i));
+    std::vector<uint32_t> new_buf = old_buf;
+    model.write_frame(new_buf, driver.framebuffer);
+
+    // the DMA runs while the driver polls its position
+    size_t start = pin_driver.output.size();
+    pin_driver.run_on_read = 8;
+    driver.flip();
+    pin_driver.run_on_read = 0;
+    pin_driver.run(2 * buf_len);
+
+    // look at each subframe output since the flip (ending with LE at o), and
+    // check that each refresh shows just the old or new frame
+    std::vector<int> refresh_state(pin_driver.output.size() / buf_len + 1, 0);
+    for (size_t o = start + D::data_words; o < pin_driver.output.size(); o++)
+      for (auto &frame : model.subframes) {
+        if (o % buf_len != (frame.data_offset + D::data_words) % buf_len)
+          continue;
+
+        bool is_old = true, is_new = true;
+        for (size_t j = o + 1 - D::data_words; j <= o; j++) {
+          is_old &= pin_driver.output[j] == old_buf[j % buf_len];
+          is_new &= pin_driver.output[j] == new_buf[j % buf_len];
+        }
+        REQUIRE((is_old || is_new));
+        if (is_old && is_new) continue;
+
+        int &state = refresh_state[o / buf_len];
+        int frame_state = is_new ? 2 : 1;
+        if (state == 0) state = frame_state;
+        REQUIRE(state == frame_state);
+      }
+
+    // the new frame is shown from the refresh after the one in which the
+    // flip started
+    size_t first = start / buf_len;
+    for (size_t r = first; r < refresh_state.size(); r++) {
+      if (r > first + 1 && refresh_state[r]) REQUIRE(refresh_state[r] == 2);
+      if (r > first && refresh_state[r - 1] == 2)
+        REQUIRE(refresh_state[r] != 1);
+    }
+  }
+}
+
+TEST_CASE("race_beam_segments") {
+  // with one segment, the read position never moves
+  Pins<D> pins{};
+  DisplayDriver<D, SimDriver, false, true> one(pins, 1, 8);
+  REQUIRE(one.num_segments == 1);
+  REQUIRE(!one.can_race_beam());
+
+  DisplayDriver<D, SimDriver, false, true> many(pins, 1, 8, {true, 64});
+  REQUIRE(many.can_race_beam());
+  DisplayDriver<D, SimDriver, true, true> double_buffered(pins, 1, 8,
+                                                          {true, 64});
+  REQUIRE(!double_buffered.can_race_beam());
+}
+
+TEST_CASE("race_beam_blanked") {
+  // nothing is output while blanked, so the frame is written at once
+  Pins<D> pins{};
+  DisplayDriver<D, SimDriver, false, true> driver(pins, 1, 8, {true, 64});
+  driver.race_beam = true;
+  auto &pin_driver = driver.pin_driver;
+  size_t buf_len = driver.buffer_model.buf_len;
+
+  pin_driver.run(buf_len / 3);
+  driver.blank();
+  Image im = random_image<D>(8, 3);
+  write_image<D>(driver, im);
+  driver.flip();
+
+  driver.unblank();
+  pin_driver.run(buf_len);
+  std::vector<uint32_t> refresh(pin_driver.output.end() - buf_len,
+                                pin_driver.output.end());
+  check_image(decode_waveform<D>(refresh), im, 1);
+}
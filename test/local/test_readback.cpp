@@ -0,0 +1,132 @@
+#include <dmatrix/display_model.h>
+#include <dmatrix/driver.h>
+
+#include "catch.hpp"
+#include "dummy_driver.h"
+
+using namespace DMAtrix;
+
+namespace {
+  // image as interleaved (r, g, b) values in row-major order
+  template <typename D>
+  std::vector<uint8_t> to_rgb(const Image &im) {
+    std::vector<uint8_t> rgb;
+    for (int row = 0; row < (int)D::rows; row++)
+      for (int col = 0; col < (int)D::cols; col++)
+        for (int color = 0; color < (int)D::colors; color++)
+          rgb.push_back(im(row, col, color));
+    return rgb;
+  }
+
+  // write a random image to driver, and check that reading it back in every
+  // way gives the image with the bits below the lowest bitplane cleared
+  template <typename D, typename Driver>
+  void check_readback(Driver &driver, size_t num_bits) {
+    std::vector<uint8_t> rgb = to_rgb<D>(random_image<D>(8, 1));
+    driver.write_image(rgb.data());
+
+    uint8_t mask = 0xff << (8 - num_bits);
+    std::vector<uint8_t> expected = rgb;
+    for (auto &value : expected) value &= mask;
+
+    std::vector<uint8_t> image(rgb.size());
+    driver.read_image(image.data());
+    REQUIRE(image == expected);
+
+    for (size_t row = 0; row < D::rows; row++)
+      for (size_t col = 0; col < D::cols; col++) {
+        uint8_t r, g, b;
+        driver.read_rgb(row, col, r, g, b);
+        const uint8_t *px = &expected[(row * D::cols + col) * D::colors];
+        REQUIRE(r == px[0]);
+        REQUIRE(g == px[1]);
+        REQUIRE(b == px[2]);
+      }
+
+    for (size_t row = 0; row < D::rows; row += 5) {
+      size_t col = row % 7, len = D::cols - col - 3;
+      std::vector<uint8_t> span(len * D::colors);
+      driver.read_span(row, col, len, span.data());
+      const uint8_t *start = &expected[(row * D::cols + col) * D::colors];
+      REQUIRE(span == std::vector<uint8_t>(start, start + span.size()));
+    }
+  }
+}
+
+TEST_CASE("readback") {
+  using D = FullDisplay<32, 64, 4>;
+  Pins<D> pins{};
+
+  SECTION("buffer") {
+    DisplayDriver<D, DummyDriver, true> driver(pins, 1, 8);
+    check_readback<D>(driver, 8);
+  }
+  SECTION("fewer bitplanes") {
+    DisplayDriver<D, DummyDriver, true> driver(pins, 1, 6);
+    check_readback<D>(driver, 6);
+  }
+  SECTION("framebuffer") {
+    DisplayDriver<D, DummyDriver, true, true> driver(pins, 1, 6);
+    check_readback<D>(driver, 6);
+  }
+  SECTION("RRGGBB") {
+    using D2 = FullDisplay<32, 64, 4, RGBOrder::RRGGBB>;
+    DisplayDriver<D2, DummyDriver, false> driver(Pins<D2>{}, 1, 8);
+    check_readback<D2>(driver, 8);
+  }
+  SECTION("wrapped") {
+    // not laid out for transposing, so read pixel by pixel
+    using D2 = WrappedDisplay<FullDisplay<32, 64, 4>>;
+    DisplayDriver<D2, DummyDriver, false> driver(Pins<D2>{}, 1, 8);
+    DisplayDriver<D2, DummyDriver, false, true> fb_driver(Pins<D2>{}, 1, 8);
+    check_readback<D2>(driver, 8);
+    check_readback<D2>(fb_driver, 8);
+  }
+}
+
+TEST_CASE("readback_more_bits") {
+  // more bitplanes than value bits: the low bitplanes are dropped
+  using D = FullDisplay<32, 64, 4>;
+  DisplayDriver<D, DummyDriver, false> driver(Pins<D>{}, 1, 10);
+  driver.write_rgb(3, 4, 200, 17, 255);
+  uint8_t r, g, b;
+  driver.read_rgb(3, 4, r, g, b);
+  REQUIRE(r == 200);
+  REQUIRE(g == 17);
+  REQUIRE(b == 255);
+
+  uint16_t r16, g16, b16;
+  driver.read_rgb<uint16_t, 10>(3, 4, r16, g16, b16);
+  REQUIRE(r16 == 200 << 2);
+
+  // 16 bit values, in bulk
+  std::vector<uint16_t> rgb(D::rows * D::cols * D::colors);
+  for (size_t i = 0; i < rgb.size(); i++) rgb[i] = (i * 37) & 0x3ff;
+  driver.write_image<uint16_t, 10>(rgb.data());
+  std::vector<uint16_t> image(rgb.size()), span(D::cols * D::colors);
+  driver.read_image<uint16_t, 10>(image.data());
+  REQUIRE(image == rgb);
+  driver.read_span<uint16_t, 10>(7, 0, D::cols, span.data());
+  REQUIRE(span == std::vector<uint16_t>(rgb.begin() + 7 * span.size(),
+                                        rgb.begin() + 8 * span.size()));
+}
+
+TEST_CASE("readback_cow") {
+  // reads don't copy shared segments
+  using D = FullDisplay<32, 64, 4>;
+  DisplayDriver<D, SimCOWDriver, true> driver(Pins<D>{}, 1, 8, {true, 128});
+  driver.flip_mode = FlipMode::CopyForward;
+  auto &storage = driver.pin_driver.storage;
+
+  std::vector<uint8_t> rgb = to_rgb<D>(random_image<D>(8, 2));
+  driver.write_image(rgb.data());
+  driver.flip();
+  driver.pin_driver.run(2 * driver.buffer_model.buf_len);
+  REQUIRE(driver.flip_done());
+  REQUIRE(storage.copies == 0);
+
+  std::vector<uint8_t> image(rgb.size());
+  driver.read_image(image.data());
+  REQUIRE(image == rgb);
+  REQUIRE(storage.copies == 0);
+}
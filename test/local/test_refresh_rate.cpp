@@ -0,0 +1,76 @@
+#include <dmatrix/buffer_model.h>
+#include <dmatrix/display_model.h>
+#include <dmatrix/refresh_rate.h>
+
+#include <cmath>
+#include "catch.hpp"
+#include "dummy_driver.h"
+
+using namespace DMAtrix;
+
+using D = FullDisplay<32, 64, 4>;
+
+TEST_CASE("closest_divider") {
+  ClockDivider div = closest_divider(4.0 + 1.0 / 6);
+  REQUIRE(div.num == 4);
+  REQUIRE(div.b * 6 == div.a);
+
+  // clamped to the limits
+  REQUIRE(closest_divider(1.0).divisor() == 2.0);
+  REQUIRE(closest_divider(1000.0).divisor() == 255.0);
+}
+
+TEST_CASE("solve_refresh_rate") {
+  size_t min_len = BufferModel<D>(1, 8).buf_len;
+
+  // 80MHz / (25 / 6) / 10000 = 1920Hz exactly
+  RefreshTiming timing = solve_refresh_rate(1920, min_len);
+  REQUIRE(std::abs(timing.error) < 1e-9);
+  REQUIRE(timing.buf_len >= min_len);
+  REQUIRE(timing.clock_hz <= 20000000);
+  REQUIRE(timing.refresh_hz ==
+          Approx(80000000 / timing.divider.divisor() / timing.buf_len));
+
+  for (double target : {50.0, 120.0, 1000.0, 1500.0, 2000.0}) {
+    timing = solve_refresh_rate(target, min_len);
+    REQUIRE(std::abs(timing.error) < 1e-6);
+    REQUIRE(timing.buf_len >= min_len);
+    REQUIRE(timing.clock_hz <= 20000000);
+  }
+
+  // too fast for this buffer; the error is reported
+  timing = solve_refresh_rate(4000, min_len);
+  REQUIRE(timing.buf_len == min_len);
+  REQUIRE(timing.clock_hz <= 20000000);
+  REQUIRE(timing.error < -0.4);
+}
+
+TEST_CASE("padded_buffer") {
+  BufferModel<D> model(1, 8);
+  size_t padding = 751;
+  BufferModel<D> padded(1, 8, model.buf_len + padding);
+  REQUIRE(padded.buf_len == model.buf_len + padding);
+
+  // padding is spread between the subframes
+  size_t n = model.subframes.size();
+  for (size_t i = 0; i < n; i++) {
+    size_t shift =
+        padded.subframes[i].data_offset - model.subframes[i].data_offset;
+    REQUIRE(shift == padding * i / n);
+  }
+
+  // and the image is the same
+  Image image = random_image<D>(8, 0);
+  std::vector<uint32_t> buf(model.buf_len), padded_buf(padded.buf_len);
+  model.init_buffer(buf);
+  padded.init_buffer(padded_buf);
+  for (int row = 0; row < (int)D::rows; row++)
+    for (int col = 0; col < (int)D::cols; col++) {
+      model.write_rgb<unsigned int, 8>(buf, row, col, image(row, col, 0),
+                                       image(row, col, 1), image(row, col, 2));
+      padded.write_rgb<unsigned int, 8>(padded_buf, row, col,
+                                        image(row, col, 0), image(row, col, 1),
+                                        image(row, col, 2));
+    }
+  check_image(decode_waveform<D>(padded_buf), decode_waveform<D>(buf), 1);
+}
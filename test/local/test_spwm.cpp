@@ -0,0 +1,138 @@
+#include <dmatrix/display_model.h>
+#include <dmatrix/driver.h>
+#include <dmatrix/spwm_model.h>
+
+#include "catch.hpp"
+#include "dummy_driver.h"
+#include "spwm_chip.h"
+
+using namespace DMAtrix;
+
+using D = FullDisplay<32, 64, 4>;
+
+TEST_CASE("spwm_model") {
+  Pins<D> pins{};
+  DisplayDriver<D, SimDriver, true, false, SPWMBufferModel> driver(pins, 16,
+                                                                    8);
+  auto &model = driver.buffer_model;
+  auto &pin_driver = driver.pin_driver;
+  REQUIRE(model.buf_len % model.scan_len == 0);
+
+  SPWMChipChain<D> chips;
+  for (unsigned int seed = 0; seed < 2; seed++) {
+    Image image = random_image<D>(8, seed);
+    write_image<D>(driver, image);
+    driver.flip();
+
+    // the upload is latched at the end of the PWM frame it ends in, so the
+    // last full frame after two more buffers shows the image
+    size_t start = pin_driver.output.size();
+    pin_driver.run(3 * model.buf_len);
+    REQUIRE(driver.flip_done());
+    chips.feed_all(pin_driver.output, start);
+
+    for (size_t reg = 1; reg <= 4; reg++)
+      REQUIRE(chips.regs[reg] == model.reg_value(reg));
+    REQUIRE(chips.ghosts == 0);
+    check_image(chips.last_frame, image, 1);
+  }
+}
+
+TEST_CASE("spwm_framebuffered") {
+  Pins<D> pins{};
+  DisplayDriver<D, SimDriver, false, true, SPWMBufferModel> driver(
+      pins, 4, 6, {true, 1000}, 40000);
+  auto &model = driver.buffer_model;
+  REQUIRE(model.buf_len >= 40000);
+  REQUIRE(model.buf_len % model.scan_len == 0);
+
+  Image image = random_image<D>(6, 3);
+  for (int row = 0; row < (int)D::rows; row++)
+    for (int col = 0; col < (int)D::cols; col++)
+      driver.write_rgb<uint8_t, 6>(row, col, image(row, col, 0),
+                                   image(row, col, 1), image(row, col, 2));
+
+  // writing behind the upload while it runs
+  driver.race_beam = true;
+  driver.pin_driver.run_on_read = 100;
+  driver.flip();
+
+  SPWMChipChain<D> chips;
+  driver.pin_driver.run(2 * model.buf_len);
+  chips.feed_all(driver.pin_driver.output);
+
+  REQUIRE(chips.ghosts == 0);
+  check_image(chips.last_frame, image, 1);
+}
+
+/// a DMA buffer of SimDriver, through which every 8 accesses run the DMA for
+/// a word, so that it keeps running while write_frame_behind writes, taking
+/// longer to write each shift than to output it
+template <typename Sim>
+struct RunningBuffer {
+  Sim &sim;
+  std::vector<uint32_t> &buf;
+  size_t accesses = 0;
+
+  uint32_t &operator[](size_t i) {
+    if (++accesses % 8 == 0) sim.run(1);
+    return buf[i];
+  }
+};
+
+TEST_CASE("spwm_race_beam_running") {
+  Pins<D> pins{};
+  DisplayDriver<D, SimDriver, false, true, SPWMBufferModel> driver(
+      pins, 4, 6, {true, 1000});
+  auto &model = driver.buffer_model;
+  auto &sim = driver.pin_driver;
+  auto write = [&](const Image &image) {
+    for (int row = 0; row < (int)D::rows; row++)
+      for (int col = 0; col < (int)D::cols; col++)
+        driver.write_rgb<uint8_t, 6>(row, col, image(row, col, 0),
+                                     image(row, col, 1), image(row, col, 2));
+  };
+
+  Image old_image = random_image<D>(6, 4), image = random_image<D>(6, 5);
+  write(old_image);
+  driver.flip();
+  sim.run(2 * model.buf_len);
+
+  auto same = [](const Image &a, const Image &b) {
+    Eigen::Tensor<bool, 0> eq = (a == b).all();
+    return eq();
+  };
+
+  // start writing at various points in the refresh, while the DMA runs
+  // both while polling the position and while writing
+  sim.run_on_read = 16;
+  for (size_t offset : {0, 5000, 17000}) {
+    write(image);
+    sim.run(offset);
+    size_t start = sim.output.size();
+
+    RunningBuffer<decltype(sim)> buf{sim, sim.buffers[0]};
+    model.write_frame_behind(buf, driver.framebuffer,
+                             [&]() { return sim.read_position(); });
+    REQUIRE(sim.output.size() - start > model.buf_len / 2);
+    sim.run(3 * model.buf_len);
+
+    // every PWM frame which ends after the write started shows the old
+    // image and then the new one, never a mix
+    SPWMChipChain<D> chips;
+    bool seen_new = false;
+    for (size_t i = 0; i < sim.output.size(); i++) {
+      size_t frames = chips.frames;
+      chips.feed(sim.output[i]);
+      if (i < start || chips.frames == frames) continue;
+
+      bool is_new = same(chips.last_frame, image);
+      REQUIRE((is_new || (!seen_new && same(chips.last_frame, old_image))));
+      seen_new |= is_new;
+    }
+    REQUIRE(seen_new);
+    REQUIRE(chips.ghosts == 0);
+
+    std::swap(old_image, image);
+  }
+}
@@ -0,0 +1,120 @@
+#include <dmatrix/display_model.h>
+#include <dmatrix/driver.h>
+#include <dmatrix/stream_driver.h>
+
+#include "catch.hpp"
+#include "dummy_driver.h"
+
+using namespace DMAtrix;
+
+using D = FullDisplay<32, 64, 4>;
+static Pins<D> pins{1, 2, 3, {4, 5, 6, 7}, {8, 9, 10, 11, 12, 13}};
+
+TEST_CASE("stream_matches_buffer") {
+  // chunk lengths which do and don't divide the buffer length, and one
+  // longer than most subframes
+  for (size_t chunk_len : {1, 100, 333, 4096}) {
+    DummyStreamDriver<Pins<D>::num_bits>::Config config;
+    config.chunk_len = chunk_len;
+    StreamingDisplayDriver<D, DummyStreamDriver, false> stream(pins, 2, 8,
+                                                                config);
+    DisplayDriver<D, DummyDriver, false> driver(pins, 2, 8);
+
+    Image im = random_image<D>(8, chunk_len);
+    write_image<D>(stream, im);
+    write_image<D>(driver, im);
+
+    size_t buf_len = driver.buffer_model.buf_len;
+    auto out = stream.pin_driver.capture(2 * buf_len);
+
+    for (size_t i = 0; i < 2 * buf_len; i++)
+      REQUIRE(out[i] == driver.pin_driver.buffers[0][i % buf_len]);
+
+    check_image(decode_waveform<D>(out), im, 4);
+  }
+}
+
+TEST_CASE("stream_flip") {
+  StreamingDisplayDriver<D, DummyStreamDriver, true> stream(pins, 1, 8);
+  size_t buf_len = stream.buffer_model.buf_len;
+
+  Image im_a = random_image<D>(8, 1);
+  Image im_b = random_image<D>(8, 2);
+
+  write_image<D>(stream, im_a);
+  stream.flip();
+  REQUIRE(!stream.flip_done());
+
+  // the stream starts at the beginning of a refresh, so flips immediately
+  auto refresh = stream.pin_driver.capture(buf_len);
+  REQUIRE(stream.flip_done());
+  check_image(decode_waveform<D>(refresh), im_a, 1);
+
+  // flip part-way through a refresh; the change must wait for the next one
+  stream.pin_driver.capture(buf_len / 3);
+  write_image<D>(stream, im_b);
+  stream.flip();
+
+  REQUIRE(!stream.flip_done());
+  stream.pin_driver.capture(buf_len - buf_len / 3);
+
+  refresh = stream.pin_driver.capture(buf_len);
+  REQUIRE(stream.flip_done());
+  check_image(decode_waveform<D>(refresh), im_b, 1);
+}
+
+// clocks for which bitplane bit is shown per refresh, over the refresh length
+static double oe_fraction(const BufferModel<D> &model, size_t bit) {
+  size_t oe_clocks = 0;
+  for (auto &frame : model.subframes)
+    if (frame.bit == bit) oe_clocks += frame.oe_length;
+  return (double)oe_clocks / model.buf_len;
+}
+
+TEST_CASE("stream_adaptive") {
+  // chunks longer than the shortest schedule wrap more than once
+  for (size_t chunk_len : {256, 4096}) {
+    DummyStreamDriver<Pins<D>::num_bits>::Config config;
+    config.chunk_len = chunk_len;
+    StreamingDisplayDriver<D, DummyStreamDriver, true> stream(pins, 4, 8,
+                                                              config, 0, true);
+    BufferModel<D> &full = stream.buffer_model;
+    size_t full_len = full.buf_len;
+
+    for (size_t bits : {1, 4, 8, 2}) {
+      Image im = random_image<D>(bits, bits);
+      write_image<D>(stream, im);
+      REQUIRE(stream.framebuffers[stream.back_buffer].used_bits() == bits);
+      stream.flip();
+
+      // the flip happens within a refresh and a chunk, after which the
+      // output loops the new schedule; decoding a loop doesn't depend on
+      // where it starts
+      auto out = stream.pin_driver.capture(2 * full_len + chunk_len);
+      REQUIRE(stream.flip_done());
+
+      BufferModel<D> &model =
+          bits < 8 ? stream.schedules[bits - 1] : stream.buffer_model;
+      REQUIRE(stream.front_model == &model);
+      if (bits < 8) REQUIRE(model.buf_len < full_len);
+
+      // brightness is unchanged: each bitplane is shown for the same
+      // fraction of the refresh
+      for (size_t bit = 0; bit < bits; bit++)
+        REQUIRE(oe_fraction(model, bit) ==
+                Approx(oe_fraction(full, bit)).epsilon(0.001));
+
+      std::vector<uint32_t> refresh(out.end() - model.buf_len, out.end());
+      check_image(decode_waveform<D>(refresh), im, model.weights[0]);
+    }
+  }
+}
+
+TEST_CASE("stream_adaptive_min_pulse") {
+  // pulses can't be shortened below 1 clock, and a shorter refresh would
+  // make dim frames brighter, so every schedule is padded to the full length
+  StreamingDisplayDriver<D, DummyStreamDriver, true> stream(pins, 1, 8, {}, 0,
+                                                            true);
+  for (auto &model : stream.schedules)
+    REQUIRE(model.buf_len == stream.buffer_model.buf_len);
+}
@@ -0,0 +1,73 @@
+#include <dmatrix/display_model.h>
+#include <dmatrix/driver.h>
+#include <dmatrix/text.h>
+
+#include "catch.hpp"
+#include "dummy_driver.h"
+
+using namespace DMAtrix;
+
+/// draw text pixel by pixel, for comparison
+template <typename D, typename Driver>
+void draw_text_pixels(Driver &driver, const Font &font, int row, int col,
+                      const char *text, uint8_t r, uint8_t g, uint8_t b) {
+  for (; *text; text++, col += font.width) {
+    unsigned char c = *text;
+    if (c < font.first || c >= font.first + font.count) continue;
+    for (int y = 0; y < (int)font.height; y++)
+      for (int x = 0; x < (int)font.width; x++) {
+        uint32_t bits = font.bitmap[(c - font.first) * font.height + y];
+        int px_row = row + y, px_col = col + x;
+        if (((bits >> x) & 1) && px_row >= 0 && px_row < (int)D::rows &&
+            px_col >= 0 && px_col < (int)D::cols)
+          driver.write_rgb(px_row, px_col, r, g, b);
+      }
+  }
+}
+
+template <typename D, bool framebuffered>
+void test_text() {
+  // random glyphs for 'A' to 'Z'
+  std::vector<uint32_t> bitmap(26 * 7);
+  for (auto &row : bitmap) row = rand() & 0x1f;
+  Font font{'A', 26, 6, 7, bitmap.data()};
+
+  Pins<D> pins{1, 2, 3, {4, 5, 6, 7}, {}};
+  DisplayDriver<D, DummyDriver, false, framebuffered> driver(pins, 1, 8);
+  DisplayDriver<D, DummyDriver, false> reference(pins, 1, 8);
+
+  Image im = random_image<D>(8, 5);
+  write_image<D>(driver, im);
+  write_image<D>(reference, im);
+
+  GlyphCache<D> cache(font, 8, 255, 31, 128);
+  const char *text = "HELLO, WORLD";
+  // in the middle, and clipped on each side
+  for (auto pos : {std::make_pair(3, 2), std::make_pair(-3, -4),
+                   std::make_pair(28, 50)}) {
+    int end = driver.draw_text(cache, pos.first, pos.second, text);
+    REQUIRE(end == pos.second + 6 * 12);
+    draw_text_pixels<D>(reference, font, pos.first, pos.second, text, 255, 31,
+                     128);
+  }
+
+  driver.flip();
+  REQUIRE(driver.pin_driver.buffers[0] == reference.pin_driver.buffers[0]);
+}
+
+/// FullDisplay with the columns mirrored, so that runs of pixels along a
+/// row aren't in consecutive words
+struct MirroredDisplay : FullDisplay<32, 64, 4> {
+  static constexpr DataAddr encode(size_t row, size_t col, size_t color) {
+    return FullDisplay<32, 64, 4>::encode(row, cols - 1 - col, color);
+  }
+};
+
+TEST_CASE("text") {
+  test_text<FullDisplay<32, 64, 4>, false>();
+  test_text<FullDisplay<32, 64, 4>, true>();
+  test_text<WrappedDisplay<FullDisplay<32, 64, 4>>, false>();
+  // drawn pixel by pixel
+  test_text<MirroredDisplay, false>();
+  test_text<MirroredDisplay, true>();
+}
@@ -0,0 +1,91 @@
+#include <dmatrix/display_model.h>
+#include <dmatrix/driver.h>
+#include <dmatrix/transpose.h>
+
+#include "catch.hpp"
+#include "dummy_driver.h"
+
+using namespace DMAtrix;
+
+template <typename Kernel, typename T>
+void check_kernel() {
+  for (size_t n = 0; n <= 32; n++) {
+    T values[32];
+    for (auto &v : values) v = rand();
+
+    uint32_t expected[sizeof(T) * 8], actual[sizeof(T) * 8];
+    TransposeScalar::transpose(values, n, expected);
+    for (auto &p : actual) p = rand();
+    Kernel::transpose(values, n, actual);
+
+    for (size_t b = 0; b < sizeof(T) * 8; b++) REQUIRE(actual[b] == expected[b]);
+  }
+}
+
+template <typename Kernel>
+void check_kernel() {
+  check_kernel<Kernel, uint8_t>();
+  check_kernel<Kernel, uint16_t>();
+}
+
+TEST_CASE("transpose_kernels") {
+  check_kernel<TransposeSWAR>();
+#if defined(__SSE2__)
+  check_kernel<TransposeSSE2>();
+#endif
+#if defined(__AVX2__)
+  check_kernel<TransposeAVX2>();
+#endif
+}
+
+/// check that write_image matches write_rgb exactly, for a given kernel
+template <typename D, typename Kernel, typename T, size_t num_bits_value,
+          bool framebuffered>
+void check_write_image(size_t num_bits) {
+  Pins<D> pins{};
+  DisplayDriver<D, DummyDriver, false, framebuffered> driver(pins, 1,
+                                                             num_bits);
+  DisplayDriver<D, DummyDriver, false> reference(pins, 1, num_bits);
+
+  std::vector<T> rgb(D::rows * D::cols * 3);
+  for (auto &v : rgb) v = rand() & ((1 << num_bits_value) - 1);
+
+  if (framebuffered)
+    driver.framebuffer.template write_image<T, num_bits_value, Kernel>(
+        rgb.data());
+  else
+    driver.buffer_model.template write_image<T, num_bits_value, Kernel>(
+        driver.pin_driver.buffers[0], rgb.data());
+  driver.flip();
+
+  for (size_t row = 0; row < D::rows; row++)
+    for (size_t col = 0; col < D::cols; col++) {
+      T *px = &rgb[(row * D::cols + col) * 3];
+      reference.template write_rgb<T, num_bits_value>(row, col, px[0], px[1],
+                                                      px[2]);
+    }
+
+  REQUIRE(driver.pin_driver.buffers[0] == reference.pin_driver.buffers[0]);
+}
+
+template <typename Kernel>
+void check_write_image() {
+  using D = FullDisplay<32, 64, 4>;
+  using D_RRGGBB = FullDisplay<32, 64, 4, RGBOrder::RRGGBB>;
+  using D_wide = FullDisplay<64, 64, 3>;
+  check_write_image<D, Kernel, uint8_t, 8, false>(8);
+  check_write_image<D, Kernel, uint8_t, 8, false>(10);
+  check_write_image<D, Kernel, uint8_t, 8, true>(6);
+  check_write_image<D_RRGGBB, Kernel, uint16_t, 12, false>(10);
+  check_write_image<D_wide, Kernel, uint16_t, 16, true>(16);
+}
+
+TEST_CASE("write_image") {
+  check_write_image<TransposeScalar>();
+  check_write_image<TransposeSWAR>();
+  check_write_image<TransposeBest>();
+
+  // falls back to per-pixel writes
+  using D = WrappedDisplay<FullDisplay<32, 64, 4>>;
+  check_write_image<D, TransposeBest, uint8_t, 8, false>(8);
+}